@@ -0,0 +1,458 @@
+/**
+ * Measurement engine of the benchmarks: warmup, adaptive repetition, robust
+ * statistics, CPU pinning and CSV/JSON reports with their metadata.
+ * @file benchmark.h
+ */
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sched.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+namespace sa { // sa = sorting algorithms
+namespace bench {
+    /// How many times a measurement is repeated.
+    struct BenchOptions {
+        size_t warmup{1};       //!< Untimed runs before the timed ones.
+        size_t min_runs{5};     //!< Timed runs always done.
+        size_t max_runs{50};    //!< Timed runs never exceeded.
+        double target_ci{0.02}; //!< Stop once the 95% CI half-width is below this fraction of the mean.
+        double max_seconds{2};  //!< Stop after this much measuring (past `min_runs`), even if the CI is wider.
+    };
+
+    /// Statistics of the timed runs of one measurement.
+    struct Summary {
+        size_t runs{0};     //!< Timed runs.
+        size_t outliers{0}; //!< Runs outside the Tukey fences, left out of mean, stddev and ci.
+        double mean{0};
+        double stddev{0};
+        double ci{0};       //!< Half-width of the 95% confidence interval of the mean, relative to it.
+        double median{0};
+        double p10{0};
+        double p90{0};
+        double min{0};
+        double max{0};
+    };
+
+    /// Two-sided 95% quantile of Student's t distribution with `df` degrees of freedom.
+    inline double t_quantile_95(size_t df) {
+        static constexpr double TABLE[] {
+            12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+            2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+            2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+        };
+        if (df == 0)
+            return std::numeric_limits<double>::infinity();
+        if (df <= std::size(TABLE))
+            return TABLE[df - 1];
+        constexpr double Z {1.959964};
+        return Z + (Z * Z * Z + Z) / (4.0 * df); // first term of the Cornish-Fisher expansion
+    }
+
+    /// Linearly interpolated `q` quantile of the sorted `values`.
+    inline double quantile(const std::vector<double>& values, double q) {
+        auto pos {q * (values.size() - 1)};
+        auto lower {static_cast<size_t>(pos)};
+        if (lower + 1 >= values.size())
+            return values.back();
+        return values[lower] + (pos - lower) * (values[lower + 1] - values[lower]);
+    }
+
+    /**
+     * @brief Computes the statistics of `samples`.
+     *
+     * Order statistics use every sample. Mean, standard deviation and confidence
+     * interval leave out the outliers — samples farther than 1.5 interquartile ranges
+     * from the quartiles — so one page-fault storm does not widen them.
+     */
+    inline Summary summarize(std::vector<double> samples) {
+        Summary s;
+        s.runs = samples.size();
+        if (samples.empty())
+            return s;
+        std::sort(samples.begin(), samples.end());
+        s.min = samples.front();
+        s.max = samples.back();
+        s.median = quantile(samples, 0.5);
+        s.p10 = quantile(samples, 0.1);
+        s.p90 = quantile(samples, 0.9);
+        auto q1 {quantile(samples, 0.25)};
+        auto q3 {quantile(samples, 0.75)};
+        auto low {q1 - 1.5 * (q3 - q1)};
+        auto high {q3 + 1.5 * (q3 - q1)};
+
+        size_t n {0};
+        double sum {0};
+        for (auto x : samples)
+            if (x >= low and x <= high) {
+                sum += x;
+                n++;
+            }
+        s.outliers = s.runs - n;
+        s.mean = sum / n;
+        double squares {0};
+        for (auto x : samples)
+            if (x >= low and x <= high)
+                squares += (x - s.mean) * (x - s.mean);
+        s.stddev = n > 1 ? std::sqrt(squares / (n - 1)) : 0;
+        s.ci = n > 1 ? t_quantile_95(n - 1) * s.stddev / std::sqrt(static_cast<double>(n)) / s.mean
+                     : std::numeric_limits<double>::infinity();
+        return s;
+    }
+
+    /**
+     * @brief Measures `sample`, which runs the code once and returns its time in ms.
+     *
+     * Runs `options.warmup` untimed samples, then repeats until at least `min_runs`
+     * samples were taken and either the relative confidence interval is below
+     * `target_ci`, `max_runs` was reached or `max_seconds` went by. The caller times
+     * the code itself, so it can leave its setup (copying the input, say) out of it.
+     */
+    template< typename Sample >
+    Summary measure(const BenchOptions& options, Sample sample) {
+        for (size_t i {0}; i < options.warmup; i++)
+            sample();
+        std::vector<double> samples;
+        auto start {std::chrono::steady_clock::now()};
+        while (samples.size() < options.max_runs) {
+            samples.push_back(sample());
+            if (samples.size() < options.min_runs)
+                continue;
+            std::chrono::duration<double> spent {std::chrono::steady_clock::now() - start};
+            if (spent.count() >= options.max_seconds or summarize(samples).ci <= options.target_ci)
+                break;
+        }
+        return summarize(std::move(samples));
+    }
+
+    /**
+     * @brief Pins every thread of the process, one per CPU, starting at `first_cpu`.
+     *
+     * Threads are taken in the order of their ids, so the main thread gets `first_cpu`
+     * and the thread pool workers (built after it) the following CPUs, wrapping around.
+     * @return false if some thread could not be pinned.
+     */
+    inline bool pin_threads(size_t first_cpu) {
+        std::vector<pid_t> tids;
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator{"/proc/self/task", ec})
+            tids.push_back(static_cast<pid_t>(std::stol(entry.path().filename().string())));
+        if (tids.empty())
+            tids.push_back(0);
+        std::sort(tids.begin(), tids.end());
+        auto n_cpus {std::max(1u, std::thread::hardware_concurrency())};
+        bool pinned {true};
+        for (size_t i {0}; i < tids.size(); i++) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET((first_cpu + i) % n_cpus, &set);
+            pinned = sched_setaffinity(tids[i], sizeof(set), &set) == 0 and pinned;
+        }
+        return pinned;
+    }
+
+    /// Pins the calling thread to `cpu`; returns false if it could not.
+    inline bool pin_this_thread(size_t cpu) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return sched_setaffinity(0, sizeof(set), &set) == 0;
+    }
+
+    /**
+     * @brief Parses a CPU list such as "2-5,8" into {2, 3, 4, 5, 8}.
+     * @return an empty list if `text` is not a valid list.
+     */
+    inline std::vector<size_t> parse_cpu_list(const std::string& text) {
+        std::vector<size_t> cpus;
+        std::istringstream in{text};
+        for (std::string range; std::getline(in, range, ',');) {
+            size_t first, last;
+            char dash;
+            std::istringstream parts{range};
+            if (not (parts >> first))
+                return {};
+            last = first;
+            if (parts >> dash and (dash != '-' or not (parts >> last) or last < first))
+                return {};
+            if (not parts.eof() or last >= CPU_SETSIZE)
+                return {};
+            for (auto cpu {first}; cpu <= last; cpu++)
+                cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+
+    /**
+     * @brief Runs `work(k)` on one thread per CPU in `cpus`, the k-th thread pinned to
+     * `cpus[k]`, and waits for them all.
+     * @return false if some thread could not be pinned (it still ran).
+     */
+    template< typename Work >
+    bool on_pinned_threads(const std::vector<size_t>& cpus, Work work) {
+        std::vector<std::thread> threads;
+        std::vector<char> pinned(cpus.size());
+        for (size_t k {0}; k < cpus.size(); k++)
+            threads.emplace_back([&, k] {
+                pinned[k] = pin_this_thread(cpus[k]);
+                work(k);
+            });
+        for (auto& thread : threads)
+            thread.join();
+        return std::all_of(pinned.begin(), pinned.end(), [](char p) { return p; });
+    }
+
+    /// A data (or unified) cache level.
+    struct CacheLevel {
+        unsigned level;
+        size_t bytes;
+    };
+
+    /// The data and unified caches of CPU 0 from L1 outwards, read from sysfs, or from sysconf without it.
+    inline std::vector<CacheLevel> data_caches() {
+        std::vector<CacheLevel> caches;
+        const std::string base {"/sys/devices/system/cpu/cpu0/cache/index"};
+        for (int index {0}; std::filesystem::exists(base + std::to_string(index)); index++) {
+            auto dir {base + std::to_string(index) + '/'};
+            std::ifstream level_file{dir + "level"}, type_file{dir + "type"}, size_file{dir + "size"};
+            unsigned level;
+            std::string type;
+            size_t size;
+            char unit {'B'};
+            if (not (level_file >> level and type_file >> type and size_file >> size) or type == "Instruction")
+                continue;
+            size_file >> unit;
+            size <<= unit == 'K' ? 10 : unit == 'M' ? 20 : unit == 'G' ? 30 : 0;
+            caches.push_back({level, size});
+        }
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+        if (caches.empty()) {
+            const int names[] {_SC_LEVEL1_DCACHE_SIZE, _SC_LEVEL2_CACHE_SIZE, _SC_LEVEL3_CACHE_SIZE, _SC_LEVEL4_CACHE_SIZE};
+            for (unsigned level {1}; level <= std::size(names); level++) {
+                auto size {sysconf(names[level - 1])};
+                if (size > 0)
+                    caches.push_back({level, static_cast<size_t>(size)});
+            }
+        }
+#endif
+        std::sort(caches.begin(), caches.end(), [](const CacheLevel& a, const CacheLevel& b) { return a.level < b.level; });
+        return caches;
+    }
+
+    /// Name of the smallest cache `bytes` fit in ("L1", "L2"...), or "dram".
+    inline std::string fitting_level(const std::vector<CacheLevel>& caches, size_t bytes) {
+        for (const auto& cache : caches)
+            if (bytes <= cache.bytes)
+                return 'L' + std::to_string(cache.level);
+        return "dram";
+    }
+
+    /**
+     * @brief Sizes, in elements, of a sweep across the cache hierarchy.
+     *
+     * Takes `per_octave` geometrically spaced sizes per doubling in [min_n, max_n], plus
+     * eight more per octave in the octave on each side of every cache boundary (the
+     * size whose elements of `element_bytes` fill the cache), so the cliffs are
+     * sampled densely.
+     */
+    inline std::vector<size_t> cache_sweep_sizes(const std::vector<CacheLevel>& caches, size_t element_bytes,
+                                                 size_t min_n, size_t max_n, unsigned per_octave) {
+        std::vector<size_t> sizes;
+        auto octaves {std::log2(static_cast<double>(max_n) / min_n)};
+        auto steps {static_cast<int>(std::ceil(octaves * per_octave))};
+        for (int k {0}; k <= steps; k++)
+            sizes.push_back(std::llround(min_n * std::exp2(static_cast<double>(k) / per_octave)));
+        for (const auto& cache : caches) {
+            auto boundary {static_cast<double>(cache.bytes) / element_bytes};
+            for (int k {-8}; k <= 8; k++)
+                sizes.push_back(std::llround(boundary * std::exp2(k / 8.0)));
+        }
+        sizes.erase(std::remove_if(sizes.begin(), sizes.end(), [=](size_t n) { return n < min_n or n > max_n; }), sizes.end());
+        std::sort(sizes.begin(), sizes.end());
+        sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+        return sizes;
+    }
+
+    /// Key/value pairs describing how and where a benchmark ran.
+    using Metadata = std::vector<std::pair<std::string, std::string>>;
+
+    /// Metadata of the machine, the build and the measurement options.
+    inline Metadata system_metadata(const BenchOptions& options) {
+        Metadata meta;
+        auto now {std::time(nullptr)};
+        char date[32];
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+        meta.emplace_back("date", date);
+        utsname uts;
+        if (uname(&uts) == 0) {
+            meta.emplace_back("host", uts.nodename);
+            meta.emplace_back("kernel", std::string{uts.sysname} + ' ' + uts.release);
+            meta.emplace_back("arch", uts.machine);
+        }
+        std::ifstream cpuinfo{"/proc/cpuinfo"};
+        for (std::string line; std::getline(cpuinfo, line);)
+            if (line.rfind("model name", 0) == 0) {
+                meta.emplace_back("cpu", line.substr(line.find(':') + 2));
+                break;
+            }
+        meta.emplace_back("cpus", std::to_string(std::thread::hardware_concurrency()));
+#if defined(__clang__)
+        meta.emplace_back("compiler", "clang " __clang_version__);
+#elif defined(__GNUC__)
+        meta.emplace_back("compiler", "gcc " __VERSION__);
+#endif
+#ifdef __OPTIMIZE__
+        meta.emplace_back("optimized", "yes");
+#else
+        meta.emplace_back("optimized", "no");
+#endif
+        meta.emplace_back("warmup", std::to_string(options.warmup));
+        meta.emplace_back("min_runs", std::to_string(options.min_runs));
+        meta.emplace_back("max_runs", std::to_string(options.max_runs));
+        meta.emplace_back("target_ci", std::to_string(options.target_ci));
+        meta.emplace_back("max_seconds", std::to_string(options.max_seconds));
+        return meta;
+    }
+
+    /// A cell of a result row: a number (NaN or infinite when missing) or a string.
+    struct Value {
+        std::string text;
+        bool is_string{false};
+
+        Value(double number) {
+            if (std::isfinite(number)) {
+                std::ostringstream out;
+                out << std::setprecision(12) << number;
+                text = out.str();
+            }
+        }
+        Value(std::string s) : text{std::move(s)}, is_string{true} {}
+        Value(const char* s) : text{s}, is_string{true} {}
+    };
+
+    /// A result row, as (column, value) pairs; every row must have the same columns.
+    using Row = std::vector<std::pair<std::string, Value>>;
+
+    /**
+     * @brief Writes result rows to `<prefix>.csv` and `<prefix>.json`.
+     *
+     * The CSV is written (and flushed) row by row, with the metadata as leading
+     * `# key: value` lines and missing numbers left empty. The JSON, an object with a
+     * "metadata" object and a "results" array whose missing numbers are null, is
+     * written by `close()` or the destructor. Both files are opened up front, and a file
+     * that cannot be opened or written throws, so no results are lost silently.
+     */
+    class ResultWriter {
+        std::ofstream csv;
+        std::ofstream json;
+        std::string csv_path;
+        std::string json_path;
+        Metadata metadata;
+        std::vector<Row> rows;
+        bool closed{false};
+
+        static std::string json_string(const std::string& s) {
+            std::string quoted {"\""};
+            for (auto c : s) {
+                if (c == '"' or c == '\\')
+                    quoted += '\\';
+                if (static_cast<unsigned char>(c) < 0x20)
+                    continue;
+                quoted += c;
+            }
+            return quoted + '"';
+        }
+
+        static std::string csv_string(const std::string& s) {
+            if (s.find_first_of(",\"\n") == std::string::npos)
+                return s;
+            std::string quoted {"\""};
+            for (auto c : s) {
+                if (c == '"')
+                    quoted += '"';
+                quoted += c;
+            }
+            return quoted + '"';
+        }
+
+    public:
+        ResultWriter(const std::string& prefix, Metadata meta)
+            : csv{prefix + ".csv"}, json{prefix + ".json"}, csv_path{prefix + ".csv"}, json_path{prefix + ".json"},
+              metadata{std::move(meta)} {
+            if (not csv)
+                throw std::runtime_error{"cannot write the results to " + csv_path};
+            if (not json)
+                throw std::runtime_error{"cannot write the results to " + json_path};
+            for (const auto& [key, value] : metadata)
+                csv << "# " << key << ": " << value << '\n';
+        }
+        ResultWriter(const ResultWriter&) = delete;
+        ResultWriter& operator=(const ResultWriter&) = delete;
+        /// Closes the writer; a failure to write the JSON can only be reported, on stderr.
+        ~ResultWriter() {
+            try {
+                close();
+            } catch (const std::exception& e) {
+                std::cerr << ">>> " << e.what() << '\n';
+            }
+        }
+
+        void add(Row row) {
+            if (rows.empty()) {
+                for (size_t i {0}; i < row.size(); i++)
+                    csv << (i ? "," : "") << row[i].first;
+                csv << '\n';
+            }
+            for (size_t i {0}; i < row.size(); i++)
+                csv << (i ? "," : "") << (row[i].second.is_string ? csv_string(row[i].second.text) : row[i].second.text);
+            csv << std::endl;
+            if (not csv)
+                throw std::runtime_error{"cannot write the results to " + csv_path};
+            rows.push_back(std::move(row));
+        }
+
+        void close() {
+            if (closed)
+                return;
+            closed = true;
+            json << "{\n  \"metadata\": {";
+            for (size_t i {0}; i < metadata.size(); i++)
+                json << (i ? ",\n    " : "\n    ") << json_string(metadata[i].first) << ": " << json_string(metadata[i].second);
+            json << "\n  },\n  \"results\": [";
+            for (size_t r {0}; r < rows.size(); r++) {
+                json << (r ? ",\n    {" : "\n    {");
+                for (size_t i {0}; i < rows[r].size(); i++) {
+                    const auto& value {rows[r][i].second};
+                    json << (i ? ", " : "") << json_string(rows[r][i].first) << ": "
+                         << (value.is_string ? json_string(value.text) : value.text.empty() ? "null" : value.text);
+                }
+                json << '}';
+            }
+            json << "\n  ]\n}\n";
+            json.close();
+            if (not json)
+                throw std::runtime_error{"cannot write the results to " + json_path};
+        }
+    };
+};
+};
+
+#endif // BENCHMARK_H
@@ -0,0 +1,421 @@
+/**
+ * External (out-of-core) sort of binary files of fixed-width records that do not fit in memory.
+ *
+ * The input is memory mapped and cut into chunks as large as the memory budget; each chunk is
+ * sorted with one of the in-memory algorithms and written as a sorted run to a temporary file.
+ * The runs are then merged k at a time through a loser tree, reading and writing through pairs of buffers so the
+ * disk works on one block while the merge consumes the other. When there are more runs than
+ * the budget can feed at once, several merge passes are made.
+ * @author
+ * @date July 5th, 2021
+ * @file external_sort.h
+ */
+
+#ifndef EXTERNAL_SORT_H
+#define EXTERNAL_SORT_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sorting.h"
+
+namespace sa { // sa = sorting algorithms
+    /// Tuning of an external sort.
+    struct ExternalSortOptions {
+        size_t memory_budget {size_t{256} << 20}; //!< Bytes of record buffers the sort may hold at once.
+        size_t min_block_bytes {size_t{1} << 18};  //!< Smallest merge I/O block; bounds the merge fan-in.
+        std::string temp_dir;                      //!< Where run files go; empty means the system temp directory.
+    };
+
+    /// What an external sort did, for reports.
+    struct ExternalSortStats {
+        size_t records {0};      //!< Records sorted.
+        size_t runs {0};         //!< Sorted runs written by the run formation phase.
+        size_t merge_passes {0}; //!< Passes over the data made by the merge phase.
+    };
+
+    namespace external {
+        /// Throws the `errno` of a failed system call.
+        [[noreturn]] inline void throw_errno(const std::string& what) {
+            throw std::system_error{errno, std::generic_category(), what};
+        }
+
+        /// Owns a file descriptor.
+        class File {
+            int fd {-1};
+
+        public:
+            File() = default;
+            explicit File(int fd) : fd{fd} {}
+            File(const File&) = delete;
+            File& operator=(const File&) = delete;
+            File(File&& other) noexcept : fd{std::exchange(other.fd, -1)} {}
+            File& operator=(File&& other) noexcept {
+                std::swap(fd, other.fd);
+                return *this;
+            }
+            ~File() {
+                if (fd >= 0)
+                    ::close(fd);
+            }
+
+            int get() const { return fd; }
+
+            static File open(const std::string& path, int flags) {
+                int fd {::open(path.c_str(), flags | O_CLOEXEC, 0644)};
+                if (fd < 0)
+                    throw_errno("cannot open " + path);
+                return File{fd};
+            }
+
+            /// Creates an anonymous temporary file in `dir`: it is unlinked at once and vanishes on close.
+            static File temporary(std::string dir) {
+                if (dir.empty())
+                    dir = std::filesystem::temp_directory_path().string();
+                auto path {dir + "/sa_runs_XXXXXX"};
+                int fd {::mkstemp(path.data())};
+                if (fd < 0)
+                    throw_errno("cannot create a temporary file in " + dir);
+                ::unlink(path.c_str());
+                return File{fd};
+            }
+
+            size_t size() const {
+                struct stat info;
+                if (::fstat(fd, &info) != 0)
+                    throw_errno("cannot stat a file");
+                return info.st_size;
+            }
+
+            /// Reads exactly `bytes` bytes at `offset`.
+            void read(void* data, size_t bytes, size_t offset) const {
+                auto out {static_cast<char*>(data)};
+                while (bytes > 0) {
+                    auto got {::pread(fd, out, bytes, offset)};
+                    if (got < 0 and errno == EINTR)
+                        continue;
+                    if (got < 0)
+                        throw_errno("cannot read a run");
+                    if (got == 0)
+                        throw std::runtime_error{"unexpected end of a run"};
+                    out += got;
+                    bytes -= got;
+                    offset += got;
+                }
+            }
+
+            /// Writes exactly `bytes` bytes at `offset`.
+            void write(const void* data, size_t bytes, size_t offset) const {
+                auto in {static_cast<const char*>(data)};
+                while (bytes > 0) {
+                    auto put {::pwrite(fd, in, bytes, offset)};
+                    if (put < 0 and errno == EINTR)
+                        continue;
+                    if (put < 0)
+                        throw_errno("cannot write a run");
+                    in += put;
+                    bytes -= put;
+                    offset += put;
+                }
+            }
+        };
+
+        /// Read-only memory map of a whole file, hinted for a sequential scan.
+        class Mapping {
+            void* address {nullptr};
+            size_t length {0};
+
+        public:
+            Mapping(const File& file, size_t length) : length{length} {
+                if (length == 0)
+                    return;
+                address = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, file.get(), 0);
+                if (address == MAP_FAILED)
+                    throw_errno("cannot map the input");
+                ::madvise(address, length, MADV_SEQUENTIAL);
+            }
+            Mapping(const Mapping&) = delete;
+            Mapping& operator=(const Mapping&) = delete;
+            ~Mapping() {
+                if (length > 0)
+                    ::munmap(address, length);
+            }
+
+            const char* data() const { return static_cast<const char*>(address); }
+
+            /// Drops the pages of [offset, offset + bytes) once they were consumed.
+            void release(size_t offset, size_t bytes) const {
+                auto page {static_cast<size_t>(::sysconf(_SC_PAGESIZE))};
+                auto begin {offset / page * page};
+                ::madvise(static_cast<char*>(address) + begin, offset + bytes - begin, MADV_DONTNEED);
+            }
+        };
+
+        /// A sorted run: `count` records stored from record `offset` of a run file.
+        struct Run {
+            size_t offset;
+            size_t count;
+        };
+
+        /**
+         * @brief Sequential reader of a run through two blocks: while the merge consumes
+         * one of them, the next block of the run is being read into the other.
+         */
+        template< typename T >
+        class RunReader {
+            const File* file;
+            size_t next_record;   //!< First record not requested from the file yet.
+            size_t end_record;
+            size_t block_records;
+            vector<T> blocks[2];
+            size_t current {0};
+            size_t position {0};
+            size_t filled {0};    //!< Records available in the current block.
+            std::future<size_t> prefetch;
+
+            /// Starts reading the next block of the run into the idle buffer.
+            void request() {
+                auto count {std::min(block_records, end_record - next_record)};
+                auto target {blocks[1 - current].data()};
+                auto offset {next_record * sizeof(T)};
+                next_record += count;
+                prefetch = std::async(std::launch::async, [this, target, count, offset] {
+                    file->read(target, count * sizeof(T), offset);
+                    return count;
+                });
+            }
+
+            /// Switches to the prefetched block and requests the one after it.
+            void advance_block() {
+                filled = prefetch.get();
+                current = 1 - current;
+                position = 0;
+                if (next_record < end_record)
+                    request();
+            }
+
+        public:
+            RunReader(const File& file, Run run, size_t block_records)
+                : file{&file}, next_record{run.offset}, end_record{run.offset + run.count},
+                  block_records{block_records} {
+                blocks[0].resize(std::min(block_records, run.count));
+                blocks[1].resize(std::min(block_records, run.count));
+                if (run.count > 0) {
+                    request();
+                    advance_block();
+                }
+            }
+            RunReader(const RunReader&) = delete;
+            RunReader& operator=(const RunReader&) = delete;
+            ~RunReader() {
+                if (prefetch.valid())
+                    prefetch.wait();
+            }
+
+            bool empty() const { return position == filled; }
+            const T& head() const { return blocks[current][position]; }
+
+            void pop() {
+                if (++position == filled and prefetch.valid())
+                    advance_block();
+            }
+        };
+
+        /**
+         * @brief Sequential writer through two blocks: while one block is being written,
+         * the merge fills the other.
+         */
+        template< typename T >
+        class RunWriter {
+            const File* file;
+            size_t next_offset;   //!< Byte offset of the next block.
+            vector<T> blocks[2];
+            size_t current {0};
+            size_t filled {0};
+            std::future<void> pending;
+
+            void flush_block() {
+                if (pending.valid())
+                    pending.get();
+                auto source {blocks[current].data()};
+                auto bytes {filled * sizeof(T)};
+                auto offset {next_offset};
+                next_offset += bytes;
+                pending = std::async(std::launch::async, [this, source, bytes, offset] {
+                    file->write(source, bytes, offset);
+                });
+                current = 1 - current;
+                filled = 0;
+            }
+
+        public:
+            RunWriter(const File& file, size_t record_offset, size_t block_records)
+                : file{&file}, next_offset{record_offset * sizeof(T)} {
+                blocks[0].resize(block_records);
+                blocks[1].resize(block_records);
+            }
+            RunWriter(const RunWriter&) = delete;
+            RunWriter& operator=(const RunWriter&) = delete;
+            ~RunWriter() {
+                if (pending.valid())
+                    pending.wait();
+            }
+
+            void push(const T& record) {
+                blocks[current][filled++] = record;
+                if (filled == blocks[current].size())
+                    flush_block();
+            }
+
+            /// Writes what is buffered and waits for the disk.
+            void finish() {
+                if (filled > 0)
+                    flush_block();
+                if (pending.valid())
+                    pending.get();
+            }
+        };
+
+        /**
+         * @brief Merges `runs` of `source` into one run written from record `offset` of
+         * `target`. `block_records` is the size of each of the 2 * (k + 1) buffers. Equal
+         * records leave in run order, so the merge is stable.
+         */
+        template< typename T, typename Compare >
+        void merge_runs(const File& source, const vector<Run>& runs, const File& target,
+                        size_t offset, size_t block_records, Compare cmp) {
+            vector<std::unique_ptr<RunReader<T>>> readers;
+            for (const auto& run : runs)
+                readers.push_back(std::make_unique<RunReader<T>>(source, run, block_records));
+            RunWriter<T> writer{target, offset, block_records};
+
+            // Every run holds at least one record, so tree sources and readers match.
+            LoserTree<T, Compare> tree{cmp};
+            for (auto& reader : readers) {
+                tree.add_source(reader->head());
+                reader->pop();
+            }
+            tree.build();
+            while (not tree.empty()) {
+                auto& reader {*readers[tree.winner()]};
+                writer.push(tree.top());
+                if (reader.empty()) {
+                    tree.pop_top();
+                } else {
+                    tree.replace_top(reader.head());
+                    reader.pop();
+                }
+            }
+            writer.finish();
+        }
+    };
+
+    /**
+     * @brief Sorts the fixed-width records of the binary file `input` into the file `output`
+     * holding at most `options.memory_budget` bytes of records in memory.
+     *
+     * The input is memory mapped and sorted in chunks of the budget's size with `sort_chunk`,
+     * each chunk becoming a run in a temporary file (a single chunk goes straight to the
+     * output). Runs are merged at most k at a time, with 2 * (k + 1) blocks of at least
+     * `options.min_block_bytes` fitting in the budget, in as many passes as needed. The
+     * result is stable if `sort_chunk` is.
+     *
+     * @tparam T record type, trivially copyable
+     * @tparam Compare type of predicate to compare records
+     * @tparam ChunkSort in-memory sort called as `sort_chunk(first, last, cmp)`
+     * @param input path of the file to be sorted, a whole number of records long
+     * @param output path of the sorted file, created or truncated
+     * @param cmp predicate that returns true if the first argument is less than the second
+     * @param options memory budget, block size and temporary directory
+     * @param sort_chunk in-memory sort applied to each chunk
+     * @return counts of records, runs and merge passes
+     */
+    template< typename T, typename Compare, typename ChunkSort >
+    ExternalSortStats external_sort(const std::string& input, const std::string& output, Compare cmp,
+                                    const ExternalSortOptions& options, ChunkSort sort_chunk) {
+        static_assert(std::is_trivially_copyable_v<T>, "external_sort stores records as raw bytes");
+        using external::File;
+        using external::Run;
+
+        auto in {File::open(input, O_RDONLY)};
+        auto in_bytes {in.size()};
+        if (in_bytes % sizeof(T) != 0)
+            throw std::invalid_argument{input + " is not a whole number of records"};
+        auto out {File::open(output, O_RDWR | O_CREAT | O_TRUNC)};
+
+        ExternalSortStats stats;
+        stats.records = in_bytes / sizeof(T);
+        if (stats.records == 0)
+            return stats;
+
+        // Run formation: sort budget-sized chunks of the mapped input.
+        auto chunk_records {std::max<size_t>(options.memory_budget / sizeof(T), 1)};
+        auto n_chunks {(stats.records + chunk_records - 1) / chunk_records};
+        File runs_file {n_chunks > 1 ? File::temporary(options.temp_dir) : File{}};
+        const auto& run_target {n_chunks > 1 ? runs_file : out};
+        vector<Run> runs;
+        {
+            external::Mapping mapping{in, in_bytes};
+            vector<T> chunk(std::min(chunk_records, stats.records));
+            for (size_t first {0}; first < stats.records; first += chunk_records) {
+                auto count {std::min(chunk_records, stats.records - first)};
+                std::memcpy(static_cast<void*>(chunk.data()), mapping.data() + first * sizeof(T), count * sizeof(T));
+                mapping.release(first * sizeof(T), count * sizeof(T));
+                sort_chunk(chunk.begin(), chunk.begin() + count, cmp);
+                run_target.write(chunk.data(), count * sizeof(T), first * sizeof(T));
+                runs.push_back(Run{first, count});
+            }
+        }
+        stats.runs = runs.size();
+
+        // Merge passes: k runs at a time, the last pass writing the output.
+        auto max_fan_in {std::max<size_t>(options.memory_budget / (2 * options.min_block_bytes), 3) - 1};
+        while (runs.size() > 1) {
+            auto last_pass {runs.size() <= max_fan_in};
+            auto pass_target {last_pass ? File{} : File::temporary(options.temp_dir)};
+            const auto& target {last_pass ? out : pass_target};
+            vector<Run> merged;
+            for (size_t group {0}; group < runs.size(); group += max_fan_in) {
+                vector<Run> inputs(runs.begin() + group, runs.begin() + std::min(group + max_fan_in, runs.size()));
+                Run result {inputs.front().offset, 0};
+                for (const auto& run : inputs)
+                    result.count += run.count;
+                auto block_records {std::max<size_t>(options.memory_budget / (2 * (inputs.size() + 1)) / sizeof(T), 1)};
+                external::merge_runs<T>(runs_file, inputs, target, result.offset, block_records, cmp);
+                merged.push_back(result);
+            }
+            runs = std::move(merged);
+            if (not last_pass)
+                runs_file = std::move(pass_target);
+            stats.merge_passes++;
+        }
+        return stats;
+    }
+
+    /// External sort whose chunks are sorted with `sa::quick`.
+    template< typename T, typename Compare >
+    ExternalSortStats external_sort(const std::string& input, const std::string& output, Compare cmp,
+                                    const ExternalSortOptions& options = {}) {
+        return external_sort<T>(input, output, cmp, options, [](auto first, auto last, Compare cmp) {
+            sa::quick(first, last, cmp);
+        });
+    }
+};
+#endif // EXTERNAL_SORT_H
@@ -0,0 +1,326 @@
+/**
+ * Reproducible, parallel generation of benchmark inputs, and an on-disk cache for them.
+ *
+ * Every generator draws from a counter-based random number generator: element `i`
+ * depends only on the seed and on `i`, so any slice of the input can be generated
+ * independently of the others (and so by any thread), and the same seed always
+ * gives the same input whatever the number of threads.
+ * @file generators.h
+ */
+
+#ifndef GENERATORS_H
+#define GENERATORS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "external_sort.h"
+#include "thread_pool.h"
+
+namespace sa { // sa = sorting algorithms
+namespace gen {
+    /// Below this many elements a generator runs on the calling thread alone.
+    constexpr size_t GEN_PARALLEL_CUTOFF {1 << 16};
+
+    /// The SplitMix64 finalizer: a bijective mix of the 64 bits of `x`.
+    constexpr std::uint64_t mix64(std::uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    /// Combines a seed with the values that identify one input (scenario, size...) into its own seed.
+    constexpr std::uint64_t derive_seed(std::uint64_t seed, std::uint64_t a, std::uint64_t b = 0) {
+        return mix64(seed ^ mix64(a ^ mix64(b + 0x9e3779b97f4a7c15ULL)));
+    }
+
+    /**
+     * @brief Counter-based random number generator: draw `i` is the i-th output of the
+     * SplitMix64 sequence of the seed, computed directly from `i`.
+     */
+    class CounterRng {
+        std::uint64_t key;
+
+    public:
+        explicit CounterRng(std::uint64_t seed) : key{seed} {}
+
+        /// 64 random bits.
+        std::uint64_t bits(std::uint64_t i) const {
+            return mix64(key + (i + 1) * 0x9e3779b97f4a7c15ULL);
+        }
+
+        /// A value in [0, bound), by multiply-shift (the bias is below bound / 2^64).
+        std::uint64_t below(std::uint64_t i, std::uint64_t bound) const {
+            return static_cast<std::uint64_t>((static_cast<unsigned __int128>(bits(i)) * bound) >> 64);
+        }
+
+        /// A double in [0, 1).
+        double unit(std::uint64_t i) const {
+            return (bits(i) >> 11) * 0x1.0p-53;
+        }
+    };
+
+    /**
+     * @brief A random permutation of [0, n) evaluated one index at a time, in O(1) memory.
+     *
+     * A four round Feistel network permutes the smallest power of two covering `n`,
+     * split into halves of `high_bits` and `low_bits` bits that trade places at each
+     * round; indices that land outside [0, n) are fed through it again (cycle walking),
+     * which takes fewer than two trips on average.
+     */
+    class RandomPermutation {
+        std::uint64_t n;
+        unsigned high_bits {0};
+        unsigned low_bits {0};
+        std::uint64_t keys[4];
+
+        static std::uint64_t mask(unsigned bits) { return (std::uint64_t{1} << bits) - 1; }
+
+        std::uint64_t feistel(std::uint64_t x) const {
+            auto a {high_bits};
+            auto b {low_bits};
+            auto left {x >> b};
+            auto right {x & mask(b)};
+            for (auto key : keys) {
+                auto round {((right ^ key) * 0x9e3779b97f4a7c15ULL) >> 32};
+                auto next {left ^ (round & mask(a))};
+                left = right;
+                right = next;
+                std::swap(a, b);
+            }
+            return (left << b) | right;
+        }
+
+    public:
+        RandomPermutation(std::uint64_t n, std::uint64_t seed) : n{n} {
+            unsigned bits {1};
+            while ((std::uint64_t{1} << bits) < n)
+                bits++;
+            low_bits = bits / 2;
+            high_bits = bits - low_bits;
+            for (std::uint64_t r {0}; r < 4; r++)
+                keys[r] = derive_seed(seed, r);
+        }
+
+        /// The image of `i`, which must be in [0, n).
+        std::uint64_t operator()(std::uint64_t i) const {
+            do
+                i = feistel(i);
+            while (i >= n);
+            return i;
+        }
+    };
+
+    /// Runs `body(begin, end)` over slices of [0, n), on the pool threads for large `n`.
+    template< typename Body >
+    void parallel_for(size_t n, Body body, ThreadPool& pool) {
+        if (n < GEN_PARALLEL_CUTOFF or pool.size() == 1) {
+            body(size_t{0}, n);
+            return;
+        }
+        auto n_slices {pool.size() * 4};
+        TaskGroup group{pool};
+        for (size_t s {0}; s < n_slices; s++)
+            group.run([=] { body(n * s / n_slices, n * (s + 1) / n_slices); });
+        group.wait();
+    }
+
+    /// Sets `data[i] = value_of(i)` for every i in [0, n).
+    template< typename T, typename ValueOf >
+    void fill(T* data, size_t n, ValueOf value_of, ThreadPool& pool) {
+        parallel_for(n, [=](size_t begin, size_t end) {
+            for (auto i {begin}; i < end; i++)
+                data[i] = value_of(i);
+        }, pool);
+    }
+
+    /// Largest key the generators produce: keys are in [0, max_key<T>()].
+    template< typename T >
+    constexpr std::uint64_t max_key() {
+        return static_cast<std::uint64_t>(std::numeric_limits<T>::max());
+    }
+
+    /// Uniform keys over [0, max_key<T>()].
+    template< typename T >
+    void uniform(T* data, size_t n, std::uint64_t seed, ThreadPool& pool) {
+        static_assert(std::is_integral<T>::value, "the generators produce integer keys");
+        CounterRng rng{seed};
+        constexpr auto SHIFT {64 - std::numeric_limits<T>::digits};
+        fill(data, n, [=](size_t i) { return static_cast<T>(rng.bits(i) >> SHIFT); }, pool);
+    }
+
+    /// Non-decreasing keys: element i is drawn in the i-th of n equal strides of the key range.
+    template< typename T >
+    void ascending(T* data, size_t n, std::uint64_t seed, ThreadPool& pool) {
+        CounterRng rng{seed};
+        auto stride {std::max<std::uint64_t>(1, max_key<T>() / std::max<size_t>(n, 1))};
+        fill(data, n, [=](size_t i) { return static_cast<T>(i * stride + rng.below(i, stride)); }, pool);
+    }
+
+    /// Non-increasing keys: ascending() backwards.
+    template< typename T >
+    void descending(T* data, size_t n, std::uint64_t seed, ThreadPool& pool) {
+        CounterRng rng{seed};
+        auto stride {std::max<std::uint64_t>(1, max_key<T>() / std::max<size_t>(n, 1))};
+        fill(data, n, [=](size_t i) {
+            auto j {n - 1 - i};
+            return static_cast<T>(j * stride + rng.below(j, stride));
+        }, pool);
+    }
+
+    /// Uniform keys over [0, n_keys).
+    template< typename T >
+    void few_unique(T* data, size_t n, std::uint64_t n_keys, std::uint64_t seed, ThreadPool& pool) {
+        CounterRng rng{seed};
+        fill(data, n, [=](size_t i) { return static_cast<T>(rng.below(i, n_keys)); }, pool);
+    }
+
+    /// The same random key everywhere.
+    template< typename T >
+    void constant(T* data, size_t n, std::uint64_t seed, ThreadPool& pool) {
+        T key;
+        uniform(&key, 1, seed, pool);
+        fill(data, n, [=](size_t) { return key; }, pool);
+    }
+
+    /// Ranks in [0, n_keys), rank r drawn with probability proportional to 1 / (r + 1)^exponent.
+    template< typename T >
+    void zipf(T* data, size_t n, std::uint64_t n_keys, double exponent, std::uint64_t seed, ThreadPool& pool) {
+        // Inverse transform sampling over the cumulative distribution of the ranks.
+        std::vector<double> cdf(n_keys);
+        double sum {0};
+        for (std::uint64_t rank {0}; rank < n_keys; rank++) {
+            sum += 1.0 / std::pow(rank + 1, exponent);
+            cdf[rank] = sum;
+        }
+        CounterRng rng{seed};
+        const auto* table {cdf.data()};
+        fill(data, n, [=](size_t i) {
+            auto rank {std::lower_bound(table, table + n_keys, rng.unit(i) * sum) - table};
+            return static_cast<T>(std::min<std::uint64_t>(rank, n_keys - 1));
+        }, pool);
+    }
+
+    /**
+     * @brief Swaps `fraction * n / 2` disjoint pairs of random positions, so about
+     * `fraction` of the elements leave their place.
+     *
+     * The pairs are consecutive images of a RandomPermutation, hence disjoint, and so
+     * they are swapped in parallel.
+     */
+    template< typename T >
+    void perturb(T* data, size_t n, double fraction, std::uint64_t seed, ThreadPool& pool) {
+        if (n < 2)
+            return;
+        RandomPermutation positions{n, seed};
+        auto n_pairs {std::min(static_cast<size_t>(fraction * n / 2), n / 2)};
+        parallel_for(n_pairs, [=](size_t begin, size_t end) {
+            for (auto k {begin}; k < end; k++)
+                std::swap(data[positions(2 * k)], data[positions(2 * k + 1)]);
+        }, pool);
+    }
+
+    //{{{ DATASET CACHE
+    /// Header of a cached input file; the elements follow it.
+    struct CacheHeader {
+        char magic[8];
+        std::uint64_t element_size;
+        std::uint64_t count;
+        std::uint64_t seed;
+    };
+
+    constexpr char CACHE_MAGIC[8] {'S', 'A', 'D', 'A', 'T', 'A', '0', '1'};
+
+    /// A cached input, memory mapped read-only.
+    template< typename T >
+    class MappedInput {
+        external::File file;
+        external::Mapping mapping;
+        size_t n;
+
+    public:
+        MappedInput(external::File f, size_t bytes, size_t n)
+            : file{std::move(f)}, mapping{file, bytes}, n{n} {}
+
+        const T* data() const { return reinterpret_cast<const T*>(mapping.data() + sizeof(CacheHeader)); }
+        size_t size() const { return n; }
+    };
+
+    /**
+     * @brief Directory of generated inputs, one file per (name, seed, size).
+     *
+     * An input is written once, through a temporary file of its own renamed into place, and
+     * memory mapped when it is needed again. A file whose header does not match what
+     * was asked for counts as missing.
+     */
+    class DatasetCache {
+        std::string dir;
+
+    public:
+        explicit DatasetCache(std::string directory) : dir{std::move(directory)} {
+            std::filesystem::create_directories(dir);
+        }
+
+        std::string path(const std::string& name, std::uint64_t seed, size_t n, size_t element_size) const {
+            return dir + '/' + name + '_' + std::to_string(n) + 'x' + std::to_string(element_size)
+                   + '_' + std::to_string(seed) + ".bin";
+        }
+
+        /// Maps the cached input, or returns nullptr if it is not in the cache.
+        template< typename T >
+        std::unique_ptr<MappedInput<T>> load(const std::string& name, std::uint64_t seed, size_t n) const {
+            auto file_path {path(name, seed, n, sizeof(T))};
+            if (not std::filesystem::exists(file_path))
+                return nullptr;
+            auto file {external::File::open(file_path, O_RDONLY)};
+            auto bytes {sizeof(CacheHeader) + n * sizeof(T)};
+            CacheHeader header;
+            if (file.size() != bytes)
+                return nullptr;
+            file.read(&header, sizeof(header), 0);
+            if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 or header.element_size != sizeof(T)
+                or header.count != n or header.seed != seed)
+                return nullptr;
+            return std::make_unique<MappedInput<T>>(std::move(file), bytes, n);
+        }
+
+        /// Writes the `n` elements at `data` to the cache.
+        template< typename T >
+        void store(const std::string& name, std::uint64_t seed, const T* data, size_t n) const {
+            static_assert(std::is_trivially_copyable<T>::value, "cached inputs are raw bytes");
+            auto file_path {path(name, seed, n, sizeof(T))};
+            // A temporary of its own, so writers of the same input (the cells of --cores) never share one.
+            auto temporary {file_path + ".XXXXXX"};
+            external::File file{::mkstemp(temporary.data())};
+            if (file.get() < 0)
+                external::throw_errno("cannot create a temporary file for " + file_path);
+            try {
+                ::fchmod(file.get(), 0644); // mkstemp creates it 0600
+                CacheHeader header {{}, sizeof(T), n, seed};
+                std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+                file.write(&header, sizeof(header), 0);
+                file.write(data, n * sizeof(T), sizeof(header));
+                file = external::File{};
+                std::filesystem::rename(temporary, file_path);
+            } catch (...) {
+                std::filesystem::remove(temporary);
+                throw;
+            }
+        }
+    };
+    //}}} DATASET CACHE
+};
+};
+
+#endif // GENERATORS_H
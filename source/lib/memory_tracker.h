@@ -0,0 +1,323 @@
+/**
+ * Heap and stack usage of a piece of code: allocation count, bytes allocated, peak
+ * live bytes and stack high-water.
+ *
+ * The heap is tracked by replacing the global `operator new`/`delete`. The
+ * replacements are defined by the one translation unit that defines
+ * `SA_MEMORY_HOOKS` before including this file; defining `SA_MEMORY_HOOK_MALLOC`
+ * as well interposes `malloc`/`free` (glibc only), so C allocations are seen too.
+ * Outside a tracking scope a hook costs one thread local load and a branch.
+ * @file memory_tracker.h
+ */
+
+#ifndef MEMORY_TRACKER_H
+#define MEMORY_TRACKER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <system_error>
+#include <vector>
+
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace sa { // sa = sorting algorithms
+namespace memory {
+    /// Heap and stack usage of one tracked run.
+    struct MemoryUsage {
+        std::uint64_t allocations{0}; //!< Blocks allocated.
+        std::uint64_t bytes{0};       //!< Bytes allocated, over all blocks (usable sizes).
+        std::uint64_t peak{0};        //!< Most bytes live at once, above what was live when tracking began.
+        std::uint64_t stack{0};       //!< Deepest stack use of the thread that ran the code.
+    };
+
+    struct AllocCounters {
+        std::atomic<std::uint64_t> allocations{0};
+        std::atomic<std::uint64_t> bytes{0};
+        std::atomic<std::int64_t> live{0}; //!< Signed: blocks allocated before tracking may be freed during it.
+        std::atomic<std::int64_t> peak{0};
+    };
+
+    /// Counters of the calling thread, if it is tracking on its own.
+    inline thread_local AllocCounters* thread_counters {nullptr};
+    /// Counters of the threads not tracking on their own, if the whole process is tracking.
+    inline std::atomic<AllocCounters*> process_counters {nullptr};
+
+    inline AllocCounters* active_counters() {
+        auto counters {thread_counters};
+        return counters ? counters : process_counters.load(std::memory_order_relaxed);
+    }
+
+    /// Records the allocation of the block at `p`.
+    inline void note_allocation(void* p) {
+        auto counters {active_counters()};
+        if (not counters or not p)
+            return;
+        auto size {static_cast<std::int64_t>(malloc_usable_size(p))};
+        counters->allocations.fetch_add(1, std::memory_order_relaxed);
+        counters->bytes.fetch_add(size, std::memory_order_relaxed);
+        auto live {counters->live.fetch_add(size, std::memory_order_relaxed) + size};
+        auto peak {counters->peak.load(std::memory_order_relaxed)};
+        while (live > peak and not counters->peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+    }
+
+    /// Records that the block at `p` is about to be freed.
+    inline void note_free(void* p) {
+        auto counters {active_counters()};
+        if (not counters or not p)
+            return;
+        counters->live.fetch_sub(static_cast<std::int64_t>(malloc_usable_size(p)), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Tracks the allocations of the calling thread — or of every thread not
+     * tracking on its own, with `whole_process` — while it lives.
+     */
+    class AllocScope {
+        AllocCounters counters;
+        bool whole_process;
+
+    public:
+        explicit AllocScope(bool whole_process) : whole_process{whole_process} {
+            if (whole_process)
+                process_counters = &counters;
+            else
+                thread_counters = &counters;
+        }
+        AllocScope(const AllocScope&) = delete;
+        AllocScope& operator=(const AllocScope&) = delete;
+        ~AllocScope() {
+            if (whole_process)
+                process_counters = nullptr;
+            else
+                thread_counters = nullptr;
+        }
+
+        MemoryUsage read() const {
+            return {counters.allocations.load(), counters.bytes.load(),
+                    static_cast<std::uint64_t>(std::max<std::int64_t>(counters.peak.load(), 0)), 0};
+        }
+    };
+
+    //{{{ STACK PROBE
+    /// Stack of the thread a probed function runs on; pages are only backed once touched.
+    constexpr size_t PROBE_STACK_BYTES {size_t{64} << 20};
+    /// Top of the probe stack painted with PROBE_PATTERN, so frames holding zeros are seen too.
+    constexpr size_t PROBE_PAINTED_BYTES {size_t{1} << 20};
+    constexpr unsigned char PROBE_PATTERN {0xa5};
+
+    /**
+     * @brief Runs `fn()` on a fresh thread whose stack is a new mapping, and returns how
+     * many bytes of that stack were used.
+     *
+     * The lowest byte that lost its initial value is the high-water mark: the top of the
+     * stack is painted, and below it untouched pages are not even resident (they read as
+     * zeros), so only the lowest resident page has to be scanned.
+     * What the thread library keeps at the top of the stack is measured once with an
+     * empty function and left out.
+     */
+    template< typename Function >
+    size_t stack_high_water(Function fn);
+
+    namespace detail {
+        template< typename Function >
+        size_t raw_stack_high_water(Function& fn) {
+            auto page {static_cast<size_t>(sysconf(_SC_PAGESIZE))};
+            void* base {mmap(nullptr, PROBE_STACK_BYTES, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0)};
+            if (base == MAP_FAILED)
+                throw std::system_error{errno, std::generic_category(), "cannot map a probe stack"};
+            mprotect(base, page, PROT_NONE); // guard page: overflowing the probe stack faults
+            auto end {static_cast<unsigned char*>(base) + PROBE_STACK_BYTES};
+            auto painted {end - PROBE_PAINTED_BYTES};
+            std::fill(painted, end, PROBE_PATTERN);
+
+            pthread_attr_t attr;
+            pthread_attr_init(&attr);
+            pthread_attr_setstack(&attr, base, PROBE_STACK_BYTES);
+            pthread_t thread;
+            auto run = [](void* f) -> void* {
+                (*static_cast<Function*>(f))();
+                return nullptr;
+            };
+            int error {pthread_create(&thread, &attr, run, &fn)};
+            pthread_attr_destroy(&attr);
+            if (error != 0) {
+                munmap(base, PROBE_STACK_BYTES);
+                throw std::system_error{error, std::generic_category(), "cannot start a probe thread"};
+            }
+            pthread_join(thread, nullptr);
+
+            auto first {static_cast<unsigned char*>(base) + page};
+            std::vector<unsigned char> resident((end - first) / page);
+            mincore(first, end - first, resident.data());
+            size_t used {0};
+            for (size_t p {0}; p < resident.size(); p++) {
+                if (not (resident[p] & 1))
+                    continue;
+                auto bytes {first + p * page};
+                auto touched = [painted](const unsigned char& b) { return b != (&b < painted ? 0 : PROBE_PATTERN); };
+                auto lowest {std::find_if(bytes, bytes + page, touched)};
+                if (lowest != bytes + page) {
+                    used = end - lowest;
+                    break;
+                }
+            }
+            munmap(base, PROBE_STACK_BYTES);
+            return used;
+        }
+    };
+
+    template< typename Function >
+    size_t stack_high_water(Function fn) {
+        static const size_t baseline {[] {
+            auto nothing = [] {};
+            return detail::raw_stack_high_water(nothing);
+        }()};
+        auto used {detail::raw_stack_high_water(fn)};
+        return used > baseline ? used - baseline : 0;
+    }
+    //}}} STACK PROBE
+
+    /**
+     * @brief Runs `fn()` once on a probe stack, tracking its allocations, and returns
+     * its heap and stack usage.
+     * @param whole_process also count the allocations of the other threads (the pool
+     * workers of a parallel algorithm); leave it false when other code runs meanwhile.
+     */
+    template< typename Function >
+    MemoryUsage measure(Function fn, bool whole_process) {
+        malloc_usable_size(nullptr); // binds the symbol here: lazy binding would show in the probed stack
+        MemoryUsage usage;
+        auto stack {stack_high_water([&] {
+            AllocScope scope{whole_process};
+            fn();
+            usage = scope.read();
+        })};
+        usage.stack = stack;
+        return usage;
+    }
+};
+};
+
+#ifdef SA_MEMORY_HOOKS
+//{{{ ALLOCATION HOOKS
+namespace sa {
+namespace memory {
+namespace detail {
+    inline void* allocate(std::size_t n, std::size_t alignment, bool nothrow) {
+        if (n == 0)
+            n = 1;
+        for (;;) {
+            void* p {nullptr};
+            if (alignment <= alignof(std::max_align_t))
+                p = std::malloc(n);
+            else if (posix_memalign(&p, alignment, n) != 0)
+                p = nullptr;
+            if (p) {
+#ifndef SA_MEMORY_HOOK_MALLOC
+                note_allocation(p);
+#endif
+                return p;
+            }
+            auto handler {std::get_new_handler()};
+            if (not handler) {
+                if (nothrow)
+                    return nullptr;
+                throw std::bad_alloc{};
+            }
+            handler();
+        }
+    }
+
+    inline void deallocate(void* p) {
+#ifndef SA_MEMORY_HOOK_MALLOC
+        note_free(p);
+#endif
+        std::free(p);
+    }
+};
+};
+};
+
+void* operator new(std::size_t n) { return sa::memory::detail::allocate(n, 0, false); }
+void* operator new[](std::size_t n) { return sa::memory::detail::allocate(n, 0, false); }
+void* operator new(std::size_t n, const std::nothrow_t&) noexcept { return sa::memory::detail::allocate(n, 0, true); }
+void* operator new[](std::size_t n, const std::nothrow_t&) noexcept { return sa::memory::detail::allocate(n, 0, true); }
+void* operator new(std::size_t n, std::align_val_t a) { return sa::memory::detail::allocate(n, static_cast<std::size_t>(a), false); }
+void* operator new[](std::size_t n, std::align_val_t a) { return sa::memory::detail::allocate(n, static_cast<std::size_t>(a), false); }
+void* operator new(std::size_t n, std::align_val_t a, const std::nothrow_t&) noexcept { return sa::memory::detail::allocate(n, static_cast<std::size_t>(a), true); }
+void* operator new[](std::size_t n, std::align_val_t a, const std::nothrow_t&) noexcept { return sa::memory::detail::allocate(n, static_cast<std::size_t>(a), true); }
+
+void operator delete(void* p) noexcept { sa::memory::detail::deallocate(p); }
+void operator delete[](void* p) noexcept { sa::memory::detail::deallocate(p); }
+void operator delete(void* p, std::size_t) noexcept { sa::memory::detail::deallocate(p); }
+void operator delete[](void* p, std::size_t) noexcept { sa::memory::detail::deallocate(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { sa::memory::detail::deallocate(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { sa::memory::detail::deallocate(p); }
+void operator delete(void* p, std::align_val_t) noexcept { sa::memory::detail::deallocate(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { sa::memory::detail::deallocate(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { sa::memory::detail::deallocate(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { sa::memory::detail::deallocate(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { sa::memory::detail::deallocate(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { sa::memory::detail::deallocate(p); }
+
+#ifdef SA_MEMORY_HOOK_MALLOC
+// glibc's own entry points, which the interposed functions below forward to.
+extern "C" {
+    void* __libc_malloc(std::size_t);
+    void* __libc_calloc(std::size_t, std::size_t);
+    void* __libc_realloc(void*, std::size_t);
+    void* __libc_memalign(std::size_t, std::size_t);
+    void __libc_free(void*);
+
+    void* malloc(std::size_t n) {
+        auto p {__libc_malloc(n)};
+        sa::memory::note_allocation(p);
+        return p;
+    }
+    void* calloc(std::size_t count, std::size_t n) {
+        auto p {__libc_calloc(count, n)};
+        sa::memory::note_allocation(p);
+        return p;
+    }
+    void* realloc(void* old, std::size_t n) {
+        sa::memory::note_free(old);
+        auto p {__libc_realloc(old, n)};
+        sa::memory::note_allocation(p ? p : (n == 0 ? nullptr : old)); // a failed realloc keeps the old block
+        return p;
+    }
+    void* memalign(std::size_t alignment, std::size_t n) {
+        auto p {__libc_memalign(alignment, n)};
+        sa::memory::note_allocation(p);
+        return p;
+    }
+    void* aligned_alloc(std::size_t alignment, std::size_t n) {
+        return memalign(alignment, n);
+    }
+    int posix_memalign(void** out, std::size_t alignment, std::size_t n) {
+        if (alignment % sizeof(void*) != 0 or (alignment & (alignment - 1)) != 0)
+            return EINVAL;
+        auto p {memalign(alignment, n)};
+        if (not p)
+            return ENOMEM;
+        *out = p;
+        return 0;
+    }
+    void free(void* p) {
+        sa::memory::note_free(p);
+        __libc_free(p);
+    }
+}
+#endif
+//}}} ALLOCATION HOOKS
+#endif // SA_MEMORY_HOOKS
+
+#endif // MEMORY_TRACKER_H
@@ -0,0 +1,145 @@
+/**
+ * Element and comparator wrappers that count the operations a sort performs.
+ * @file op_counter.h
+ */
+
+#ifndef OP_COUNTER_H
+#define OP_COUNTER_H
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+#include "sorting.h"
+
+namespace sa { // sa = sorting algorithms
+    /// Operations counted while sorting `Counted` elements.
+    struct OpCounts {
+        std::uint64_t comparisons{0}; //!< Calls to the comparator or to `operator<`.
+        std::uint64_t copies{0};      //!< Copy constructions and copy assignments.
+        std::uint64_t moves{0};       //!< Move constructions and move assignments.
+        std::uint64_t swaps{0};       //!< Element swaps, i.e. `std::iter_swap` and unqualified `swap`.
+    };
+
+    /**
+     * The counters. They are atomic (relaxed) so the parallel algorithms count correctly
+     * too; this makes a counted run slower than a normal one, which is why the benchmark
+     * never times it. A thread can count apart from the others with a PrivateScope.
+     */
+    namespace op_count {
+        struct Counters {
+            std::atomic<std::uint64_t> comparisons{0};
+            std::atomic<std::uint64_t> copies{0};
+            std::atomic<std::uint64_t> moves{0};
+            std::atomic<std::uint64_t> swaps{0};
+        };
+        using Counter = std::atomic<std::uint64_t> Counters::*;
+
+        /// The counters shared by every thread without a PrivateScope.
+        inline Counters shared;
+        /// The counters the calling thread adds to.
+        inline thread_local Counters* current {&shared};
+
+        /// Zeroes the counters of the calling thread.
+        inline void reset() {
+            current->comparisons = 0;
+            current->copies = 0;
+            current->moves = 0;
+            current->swaps = 0;
+        }
+
+        /// Returns the counts of the calling thread since the last `reset()`.
+        inline OpCounts read() {
+            return {current->comparisons.load(), current->copies.load(), current->moves.load(), current->swaps.load()};
+        }
+
+        inline void add(Counter counter) {
+            (current->*counter).fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /// While it lives, the calling thread counts into counters of its own.
+        class PrivateScope {
+            Counters counters;
+            Counters* previous;
+
+        public:
+            PrivateScope() : previous{current} { current = &counters; }
+            PrivateScope(const PrivateScope&) = delete;
+            PrivateScope& operator=(const PrivateScope&) = delete;
+            ~PrivateScope() { current = previous; }
+        };
+    };
+
+    /**
+     * @brief A `T` that counts its copies, moves, swaps and `<` comparisons.
+     *
+     * Sorting a range of Counted<T> instead of T runs exactly the same algorithm, apart
+     * from the SIMD network leaves, which only apply to arithmetic types.
+     * @tparam T the wrapped type
+     */
+    template< typename T >
+    class Counted {
+        T value;
+
+    public:
+        Counted() = default;
+        explicit Counted(T v) : value{std::move(v)} {}
+        Counted(const Counted& other) : value{other.value} { op_count::add(&op_count::Counters::copies); }
+        Counted(Counted&& other) noexcept : value{std::move(other.value)} { op_count::add(&op_count::Counters::moves); }
+        Counted& operator=(const Counted& other) {
+            op_count::add(&op_count::Counters::copies);
+            value = other.value;
+            return *this;
+        }
+        Counted& operator=(Counted&& other) noexcept {
+            op_count::add(&op_count::Counters::moves);
+            value = std::move(other.value);
+            return *this;
+        }
+
+        /// The wrapped value; reading it is not counted.
+        const T& get() const { return value; }
+
+        friend void swap(Counted& a, Counted& b) noexcept {
+            op_count::add(&op_count::Counters::swaps);
+            using std::swap;
+            swap(a.value, b.value);
+        }
+        friend bool operator<(const Counted& a, const Counted& b) {
+            op_count::add(&op_count::Counters::comparisons);
+            return a.value < b.value;
+        }
+    };
+
+    /// Wraps a comparator of `T` into one of Counted<T> that counts its calls.
+    template< typename Compare >
+    class CountingCompare {
+        Compare cmp;
+
+    public:
+        explicit CountingCompare(Compare c) : cmp{c} {}
+
+        template< typename T >
+        bool operator()(const Counted<T>& a, const Counted<T>& b) const {
+            op_count::add(&op_count::Counters::comparisons);
+            return cmp(a.get(), b.get());
+        }
+    };
+
+    /// Returns `cmp` wrapped into a CountingCompare.
+    template< typename Compare >
+    CountingCompare<Compare> counting(Compare cmp) {
+        return CountingCompare<Compare>{cmp};
+    }
+
+    /// Radix keys of Counted<T> are those of T; taking a key is neither a copy nor a comparison.
+    template< typename T >
+    struct radix_traits< Counted<T> > {
+        using key_type = typename radix_traits<T>::key_type;
+        static key_type key(const Counted<T>& value) {
+            return radix_traits<T>::key(value.get());
+        }
+    };
+};
+
+#endif // OP_COUNTER_H
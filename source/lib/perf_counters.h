@@ -0,0 +1,192 @@
+/**
+ * Hardware performance counters read through `perf_event_open`, for the benchmarks.
+ * @file perf_counters.h
+ */
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace sa { // sa = sorting algorithms
+    /// The events a PerfCounters collects, in the order they are reported.
+    enum class PerfEvent : size_t {
+        CYCLES,
+        INSTRUCTIONS,
+        BRANCH_MISSES,
+        L1D_MISSES,
+        LLC_MISSES,
+        DTLB_MISSES,
+        N_EVENTS,
+    };
+
+    constexpr size_t N_PERF_EVENTS {static_cast<size_t>(PerfEvent::N_EVENTS)};
+
+    /// Counts of one measurement, indexed by PerfEvent; NaN where the event is not available.
+    using PerfSample = std::array<double, N_PERF_EVENTS>;
+
+    /**
+     * @brief Counts hardware events of every thread of the process between `start()` and `stop()`.
+     *
+     * The events are opened for user space only (`exclude_kernel`), which is what an
+     * unprivileged process gets with the default `perf_event_paranoid` level. They are
+     * split into two groups, {cycles, instructions, branch misses} and the three cache
+     * misses, so each group fits in the PMU at once: the events of a group are always
+     * scheduled together, and so their ratios are exact even when the kernel has to
+     * multiplex the groups (the counts are then scaled by enabled/running time).
+     *
+     * A counter is opened per thread existing when the object is built — build it after
+     * the thread pool — and the counts of all threads are summed; or, with `this_thread`,
+     * for the calling thread only, so threads measuring side by side each count their own.
+     *
+     * Nothing here throws: an event that cannot be opened (no PMU in a virtual machine,
+     * not permitted, unknown on this CPU) reads as NaN, and `error()` tells why.
+     */
+    class PerfCounters {
+        /// An event group of one thread: `fds[0]` is the leader, `events[i]` what `fds[i]` counts.
+        struct Group {
+            std::vector<int> fds;
+            std::vector<PerfEvent> events;
+        };
+
+        std::vector<Group> groups;
+        std::array<bool, N_PERF_EVENTS> opened {}; //!< Whether any thread could open each event.
+        std::string reason;                          //!< The first error found while opening.
+
+        static int open_event(PerfEvent event, pid_t tid, int group_fd) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            auto cache_miss = [&attr](uint64_t cache) {
+                attr.type = PERF_TYPE_HW_CACHE;
+                return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            };
+            switch (event) {
+                case PerfEvent::CYCLES:        attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+                case PerfEvent::INSTRUCTIONS:  attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+                case PerfEvent::BRANCH_MISSES: attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+                case PerfEvent::L1D_MISSES:    attr.config = cache_miss(PERF_COUNT_HW_CACHE_L1D); break;
+                case PerfEvent::LLC_MISSES:    attr.config = cache_miss(PERF_COUNT_HW_CACHE_LL); break;
+                case PerfEvent::DTLB_MISSES:   attr.config = cache_miss(PERF_COUNT_HW_CACHE_DTLB); break;
+                default: return -1;
+            }
+            attr.disabled = group_fd == -1; // members follow their leader
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            return static_cast<int>(syscall(SYS_perf_event_open, &attr, tid, -1, group_fd, PERF_FLAG_FD_CLOEXEC));
+        }
+
+        void open_group(pid_t tid, std::initializer_list<PerfEvent> events) {
+            Group group;
+            for (auto event : events) {
+                int fd {open_event(event, tid, group.fds.empty() ? -1 : group.fds[0])};
+                if (fd < 0) {
+                    if (reason.empty())
+                        reason = std::string{name(event)} + ": " + std::strerror(errno);
+                    continue;
+                }
+                group.fds.push_back(fd);
+                group.events.push_back(event);
+                opened[static_cast<size_t>(event)] = true;
+            }
+            if (not group.fds.empty())
+                groups.push_back(std::move(group));
+        }
+
+        void control(unsigned long request) {
+            for (const auto& group : groups)
+                ioctl(group.fds[0], request, PERF_IOC_FLAG_GROUP);
+        }
+
+    public:
+        /// Opens the counters of every thread of the process (of the calling one with `this_thread`); `enable = false` opens none.
+        explicit PerfCounters(bool enable = true, bool this_thread = false) {
+            if (not enable) {
+                reason = "disabled";
+                return;
+            }
+            std::vector<pid_t> tids;
+            std::error_code ec;
+            if (not this_thread)
+                for (const auto& entry : std::filesystem::directory_iterator{"/proc/self/task", ec})
+                    tids.push_back(static_cast<pid_t>(std::stol(entry.path().filename().string())));
+            if (tids.empty())
+                tids.push_back(0); // the calling thread
+            for (auto tid : tids) {
+                open_group(tid, {PerfEvent::CYCLES, PerfEvent::INSTRUCTIONS, PerfEvent::BRANCH_MISSES});
+                open_group(tid, {PerfEvent::L1D_MISSES, PerfEvent::LLC_MISSES, PerfEvent::DTLB_MISSES});
+            }
+        }
+        PerfCounters(const PerfCounters&) = delete;
+        PerfCounters& operator=(const PerfCounters&) = delete;
+        ~PerfCounters() {
+            for (const auto& group : groups)
+                for (auto fd : group.fds)
+                    close(fd);
+        }
+
+        /// Whether at least one event could be opened.
+        bool available() const { return not groups.empty(); }
+        /// Whether `event` could be opened.
+        bool available(PerfEvent event) const { return opened[static_cast<size_t>(event)]; }
+        /// Why some event is missing, or an empty string when all of them were opened.
+        const std::string& error() const { return reason; }
+
+        /// Zeroes the counters and starts counting.
+        void start() {
+            control(PERF_EVENT_IOC_RESET);
+            control(PERF_EVENT_IOC_ENABLE);
+        }
+
+        /// Stops counting and returns the counts since the last `start()`.
+        PerfSample stop() {
+            control(PERF_EVENT_IOC_DISABLE);
+            PerfSample sample;
+            sample.fill(std::numeric_limits<double>::quiet_NaN());
+            for (size_t e {0}; e < N_PERF_EVENTS; e++)
+                if (opened[e])
+                    sample[e] = 0;
+            std::vector<uint64_t> data;
+            for (const auto& group : groups) {
+                // Layout of a PERF_FORMAT_GROUP read: nr, time enabled, time running, values[nr].
+                data.assign(3 + group.fds.size(), 0);
+                auto bytes {static_cast<ssize_t>(data.size() * sizeof(uint64_t))};
+                if (read(group.fds[0], data.data(), bytes) != bytes or data[2] == 0)
+                    continue; // this thread did not run while counting
+                auto scale {static_cast<double>(data[1]) / static_cast<double>(data[2])};
+                for (size_t i {0}; i < group.events.size(); i++)
+                    sample[static_cast<size_t>(group.events[i])] += static_cast<double>(data[3 + i]) * scale;
+            }
+            return sample;
+        }
+
+        /// Short name of `event`, used as a column label.
+        static const char* name(PerfEvent event) {
+            switch (event) {
+                case PerfEvent::CYCLES:        return "cycles";
+                case PerfEvent::INSTRUCTIONS:  return "instr";
+                case PerfEvent::BRANCH_MISSES: return "br_miss";
+                case PerfEvent::L1D_MISSES:    return "l1d_miss";
+                case PerfEvent::LLC_MISSES:    return "llc_miss";
+                case PerfEvent::DTLB_MISSES:   return "dtlb_miss";
+                default:                       return "?";
+            }
+        }
+    };
+};
+
+#endif // PERF_COUNTERS_H
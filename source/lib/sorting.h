@@ -27,9 +27,23 @@ using std::for_each;
 using std::copy;
 #include <cmath>
 using std::pow;
+#include <random>
 #include <string>
 using std::string;
 using std::to_string;
+#include <utility>
+using std::pair;
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <type_traits>
+
+#include "thread_pool.h"
+#include "sorting_network.h"
 
 namespace sa { // sa = sorting algorithms
     /// Prints out the range to a string and returns it to the client.
@@ -44,74 +58,315 @@ namespace sa { // sa = sorting algorithms
     }
 
     //{{{ RADIX SORT
+    /**
+     * @brief Maps a value onto an unsigned key whose natural order is the value order,
+     * so the radix sort can work on raw bits.
+     *
+     * Unsigned integers are used as they are; signed integers get their sign bit flipped;
+     * for IEEE floating point numbers the sign bit is flipped on positives and every bit
+     * is flipped on negatives.
+     */
+    template< typename T, typename Enable = void >
+    struct radix_traits;
+
+    template< typename T >
+    struct radix_traits< T, std::enable_if_t<std::is_integral<T>::value> > {
+        using key_type = std::make_unsigned_t<T>;
+        static key_type key(T value) {
+            auto k {static_cast<key_type>(value)};
+            if (std::is_signed<T>::value)
+                k ^= key_type{1} << (std::numeric_limits<key_type>::digits - 1);
+            return k;
+        }
+    };
+
+    template< typename T >
+    struct radix_traits< T, std::enable_if_t<std::is_floating_point<T>::value> > {
+        static_assert(sizeof(T) == 4 or sizeof(T) == 8, "only float and double keys are supported");
+        using key_type = std::conditional_t<sizeof(T) == 4, std::uint32_t, std::uint64_t>;
+        static key_type key(T value) {
+            key_type k;
+            std::memcpy(&k, &value, sizeof(T));
+            constexpr key_type sign {key_type{1} << (std::numeric_limits<key_type>::digits - 1)};
+            return (k & sign) ? ~k : (k | sign);
+        }
+    };
+
+    /// Number of bits per radix digit: 11 bits means 3 passes on 32-bit keys and 6 on 64-bit keys.
+    constexpr unsigned RADIX_DIGIT_BITS {11};
+
+    /**
+     * @brief LSD radix passes over the `n` elements at `data`, sorting them by the lowest
+     * `key_bits` bits of their keys with `DigitBits` bits per digit.
+     *
+     * One read pass builds the histograms of every digit; each pass then turns its
+     * histogram into offsets (prefix sum) and scatters the elements into `buffer`,
+     * alternating between `data` and `buffer`. A pass is skipped when every key has the
+     * same digit in it.
+     *
+     * @return true if the sorted elements ended up in `buffer`, false if they are in `data`.
+     */
+    template< unsigned DigitBits, typename RandomIt, typename BufferIt >
+    bool radix_passes(RandomIt data, BufferIt buffer, size_t n, unsigned key_bits) {
+        using ValueType = typename std::iterator_traits<RandomIt>::value_type;
+        using Traits = radix_traits<ValueType>;
+        using Key = typename Traits::key_type;
+        constexpr size_t N_BUCKETS {size_t{1} << DigitBits};
+        constexpr Key MASK {static_cast<Key>(N_BUCKETS - 1)};
+        auto n_passes {(key_bits + DigitBits - 1) / DigitBits};
+
+        if (n <= 1 or key_bits == 0)
+            return false;
+
+        vector<size_t> counts(n_passes * N_BUCKETS, 0);
+        for (size_t i {0}; i < n; i++) {
+            auto k {Traits::key(data[i])};
+            for (unsigned p {0}; p < n_passes; p++)
+                counts[p * N_BUCKETS + ((k >> (p * DigitBits)) & MASK)]++;
+        }
+
+        // Scatters `src` into `dst` by the digit of pass `p`, with `offsets` already summed.
+        auto pass = [n](auto src, auto dst, unsigned p, size_t* offsets) {
+            for (size_t i {0}; i < n; i++) {
+                auto digit {(Traits::key(src[i]) >> (p * DigitBits)) & MASK};
+                dst[offsets[digit]++] = std::move(src[i]);
+            }
+        };
+        bool in_buffer {false};
+        auto first_key {Traits::key(data[0])};
+        for (unsigned p {0}; p < n_passes; p++) {
+            auto offsets {&counts[p * N_BUCKETS]};
+            // Every key has the same digit here: this pass would not move anything.
+            if (offsets[(first_key >> (p * DigitBits)) & MASK] == n)
+                continue;
+            size_t sum {0};
+            for (size_t b {0}; b < N_BUCKETS; b++) {
+                auto count {offsets[b]};
+                offsets[b] = sum;
+                sum += count;
+            }
+            if (in_buffer)
+                pass(buffer, data, p, offsets);
+            else
+                pass(data, buffer, p, offsets);
+            in_buffer = not in_buffer;
+        }
+        return in_buffer;
+    }
+
+    /// LSD radix sort on [first, last) with `DigitBits` bits per digit and one scratch buffer.
+    template< unsigned DigitBits, typename RandomIt >
+    void lsd_radix(RandomIt first, RandomIt last) {
+        using ValueType = typename std::iterator_traits<RandomIt>::value_type;
+        using Key = typename radix_traits<ValueType>::key_type;
+        auto n {static_cast<size_t>(std::distance(first, last))};
+        if (n <= 1)
+            return;
+        vector<ValueType> buffer(n);
+        if (radix_passes<DigitBits>(first, buffer.begin(), n, std::numeric_limits<Key>::digits))
+            std::move(buffer.begin(), buffer.end(), first);
+    }
+
     /*!
      * This function implements the Radix Sorting Algorithm based on the **less significant digit** (LSD).
-     * 
+     *
+     * Digits are `RADIX_DIGIT_BITS` wide and each pass is a counting (histogram + prefix
+     * sum) scatter into one preallocated buffer. Signed integers, `float` and `double`
+     * are mapped by `radix_traits` onto unsigned keys, so negative values sort correctly.
+     * The sort is stable and always in non-decreasing order.
+     *
      * @note There is no need for a comparison function to be passed as argument.
      *
      * @param first Pointer/iterator to the beginning of the range we wish to sort.
      * @param last Pointer/iterator to the location just past the last valid value of the range we wish to sort.
-     * @tparam FwrdIt A forward iterator to the range we need to sort.
+     * @tparam RandomIt A random access iterator to the range we need to sort.
      * @tparam Comparator A Comparator type function tha returns true if first argument is less than the second argument.
      */
-    template < typename FwrdIt, typename Comparator, typename value_type=long >
-    void radix( FwrdIt first, FwrdIt last, Comparator){
-        int divider {1};
-        int digito {0};
-        auto max {*std::max_element(first, last)};
-
-        auto temp {*first};
-        using ValueType = decltype(temp);
-        vector<vector<ValueType>> temp_array(10);
-
-        // Loop, until gone trough all digits of max
-        while (max > 0) {
-            int counter{0};
-            for(auto i = first; i < last; i++) {
-                digito = (*i / divider) % 10;
-                temp_array[digito].push_back(*i);
-            }
-
-            for(auto i = 0; i < 10; i++) {
-                int quantidade = temp_array[i].size();
-                for(int j = 0; j < quantidade; j++) {
-                    *(first + counter) = temp_array[i][j];
-                    counter++;
-                }
+    template < typename RandomIt, typename Comparator >
+    void radix( RandomIt first, RandomIt last, Comparator){
+        lsd_radix<RADIX_DIGIT_BITS>(first, last);
+    }
+    //}}} RADIX SORT
+
+    //{{{ PARALLEL RADIX SORT
+    /// Below this many elements the parallel radix sort falls back to the sequential `radix`.
+    constexpr size_t PARALLEL_RADIX_CUTOFF {1 << 16};
+    /// Width of the most significant digit used for the top-level (MSD) split.
+    constexpr unsigned PARALLEL_RADIX_MSD_BITS {8};
+
+    /**
+     * @brief Sorts the `n` elements at `data` by the lowest `key_bits` bits of their keys,
+     * leaving the result in `data` and using `buffer` (same size) as scratch.
+     *
+     * Each thread builds the histogram of the top digit of its own slice; the histograms
+     * are merged into global offsets and each thread scatters its slice into `buffer`
+     * (MSD split). Every bucket is then sorted on its own by LSD passes, which stay in
+     * cache once the buckets are small, and buckets that are still large are split again.
+     */
+    template< typename RandomIt, typename BufferIt >
+    void parallel_radix_sort(RandomIt data, BufferIt buffer, size_t n, unsigned key_bits, ThreadPool& pool) {
+        using ValueType = typename std::iterator_traits<RandomIt>::value_type;
+        using Traits = radix_traits<ValueType>;
+        using Key = typename Traits::key_type;
+
+        if (n <= PARALLEL_RADIX_CUTOFF or key_bits <= RADIX_DIGIT_BITS) {
+            if (radix_passes<RADIX_DIGIT_BITS>(data, buffer, n, key_bits))
+                std::move(buffer, buffer + n, data);
+            return;
+        }
+
+        constexpr size_t N_BUCKETS {size_t{1} << PARALLEL_RADIX_MSD_BITS};
+        constexpr Key MASK {static_cast<Key>(N_BUCKETS - 1)};
+        auto shift {key_bits - PARALLEL_RADIX_MSD_BITS};
+        auto digit_of = [shift](const ValueType& value) {
+            return static_cast<size_t>((Traits::key(value) >> shift) & MASK);
+        };
+
+        // One histogram per slice, each computed by its own task.
+        auto n_slices {pool.size()};
+        vector<size_t> offsets(n_slices * N_BUCKETS, 0);
+        auto slice_begin = [n, n_slices](size_t t) { return n * t / n_slices; };
+        {
+            TaskGroup group{pool};
+            for (size_t t {0}; t < n_slices; t++) {
+                group.run([=, &offsets] {
+                    auto counts {&offsets[t * N_BUCKETS]};
+                    for (auto i {slice_begin(t)}; i < slice_begin(t + 1); i++)
+                        counts[digit_of(data[i])]++;
+                });
             }
+            group.wait();
+        }
 
-            for(auto j = 0; j < 10; j++) {
-                if(temp_array[j].size() > 0) {
-                    temp_array[j].clear();
-                }
+        // Global offsets: bucket by bucket, and inside each bucket slice by slice.
+        vector<size_t> bucket_begin(N_BUCKETS + 1, 0);
+        size_t sum {0};
+        for (size_t b {0}; b < N_BUCKETS; b++) {
+            bucket_begin[b] = sum;
+            for (size_t t {0}; t < n_slices; t++) {
+                auto count {offsets[t * N_BUCKETS + b]};
+                offsets[t * N_BUCKETS + b] = sum;
+                sum += count;
+            }
+        }
+        bucket_begin[N_BUCKETS] = n;
+
+        // Every key has the same top digit: go straight to the next digit, nothing to move.
+        for (size_t b {0}; b < N_BUCKETS; b++) {
+            if (bucket_begin[b + 1] - bucket_begin[b] == n) {
+                parallel_radix_sort(data, buffer, n, shift, pool);
+                return;
+            }
+        }
+
+        {
+            TaskGroup group{pool};
+            for (size_t t {0}; t < n_slices; t++) {
+                group.run([=, &offsets] {
+                    auto slice_offsets {&offsets[t * N_BUCKETS]};
+                    for (auto i {slice_begin(t)}; i < slice_begin(t + 1); i++)
+                        buffer[slice_offsets[digit_of(data[i])]++] = std::move(data[i]);
+                });
             }
+            group.wait();
+        }
+
+        // The buckets now sit in `buffer`; sort each one with `data` as its scratch space.
+        auto large_bucket {std::max(PARALLEL_RADIX_CUTOFF, n / pool.size())};
+        TaskGroup group{pool};
+        for (size_t b {0}; b < N_BUCKETS; b++) {
+            auto begin {bucket_begin[b]};
+            auto size {bucket_begin[b + 1] - begin};
+            if (size == 0)
+                continue;
+            group.run([=, &pool] {
+                if (size > large_bucket) {
+                    parallel_radix_sort(buffer + begin, data + begin, size, shift, pool);
+                    std::move(buffer + begin, buffer + begin + size, data + begin);
+                } else if (not radix_passes<RADIX_DIGIT_BITS>(buffer + begin, data + begin, size, shift)) {
+                    std::move(buffer + begin, buffer + begin + size, data + begin);
+                }
+            });
+        }
+        group.wait();
+    }
 
-            // Below update values that are based on base 10
-            divider *= 10; 
-            max /= 10;
+    /**
+     * @brief Applies a multi-threaded radix sort on the range [first, last)
+     *
+     * An MSD split on the top `PARALLEL_RADIX_MSD_BITS` bits, with per-thread histograms
+     * and per-thread scatters, is followed by an independent LSD radix sort of every bucket
+     * on its own core. Ranges smaller than `PARALLEL_RADIX_CUTOFF` use the sequential
+     * `radix`. Keys are handled as in `radix`: always in non-decreasing order.
+     *
+     * @tparam RandomIt iterator type
+     * @tparam Comparator unused, kept so every algorithm has the same signature
+     * @param first iterator to the beggining of the range to be sorted
+     * @param last iterator to the position after the end of the range to be sorted
+     * @param pool pool whose threads run the tasks
+     */
+    template< typename RandomIt, typename Comparator >
+    void parallel_radix(RandomIt first, RandomIt last, Comparator, ThreadPool& pool){
+        using ValueType = typename std::iterator_traits<RandomIt>::value_type;
+        using Key = typename radix_traits<ValueType>::key_type;
+        auto n {static_cast<size_t>(std::distance(first, last))};
+        if (n <= PARALLEL_RADIX_CUTOFF or pool.size() == 1) {
+            lsd_radix<RADIX_DIGIT_BITS>(first, last);
+            return;
         }
+        vector<ValueType> buffer(n);
+        parallel_radix_sort(first, buffer.begin(), n, std::numeric_limits<Key>::digits, pool);
+    }
 
+    /// Parallel radix sort running on the `default_pool()`.
+    template< typename RandomIt, typename Comparator >
+    void parallel_radix(RandomIt first, RandomIt last, Comparator cmp){
+        parallel_radix(first, last, cmp, default_pool());
     }
-    //}}} RADIX SORT
+    //}}} PARALLEL RADIX SORT
 
     //{{{ INSERTION SORT
     /// Implementation of the Insertion Sort algorithm.
     template< typename RandomIt, typename Compare >
     void insertion(RandomIt first, RandomIt last, Compare cmp){
+        if (first == last)
+            return;
         for (auto i = first + 1; i != last; i++) {
-            auto auxiliaryI = *i;
+            auto auxiliaryI = std::move(*i);
             auto j = i;
             for (; (j != first) && cmp(auxiliaryI, *(j - 1)); j-- ) {
-                *j = *(j-1);
+                *j = std::move(*(j-1));
             }
-            *j = auxiliaryI;
+            *j = std::move(auxiliaryI);
         }
     }
     //}}} INSERTION SORT
 
+    //{{{ SMALL SORT
+    /**
+     * @brief Leaf case of the recursive sorts: sorts a small range with a SIMD sorting
+     * network when the elements are `int32`/`int64`/`float` keys compared with `std::less`
+     * (and `network_isa()` is not `NONE`), and with insertion sort otherwise.
+     */
+    template< typename RandomIt, typename Compare >
+    void small_sort(RandomIt first, RandomIt last, Compare cmp){
+        using ValueType = typename std::iterator_traits<RandomIt>::value_type;
+        if constexpr (uses_simd_network<Compare, ValueType>::value) {
+            if (last - first <= NETWORK_MAX_SIZE and network_isa() != NetworkIsa::NONE) {
+                network_sort_block(first, last, cmp);
+                return;
+            }
+        }
+        if (last - first > 1)
+            insertion(first, last, cmp);
+    }
+    //}}} SMALL SORT
+
     //{{{ SELECTION SORT
     template< typename RandomIt, typename Compare >
     void selection(RandomIt first, RandomIt last, Compare cmp){
+        if (first == last)
+            return;
         for (auto i = first; i != last - 1; ++i) {
             auto smallest = i;
             for (auto j = i + 1; j != last; j++) {
@@ -136,6 +391,8 @@ namespace sa { // sa = sorting algorithms
      */
     template< typename RandomIt, typename Compare >
     void bubble(RandomIt first, RandomIt last, Compare cmp){
+        if (first == last)
+            return;
         do {
             auto new_last {first};
             for (auto i{ first + 1 }; i != last; i++) {
@@ -150,41 +407,147 @@ namespace sa { // sa = sorting algorithms
     //}}} BUBBLE SORT
 
     //{{{ SHELL SORT
+    /// Gap sequences (increments) for shell sort.
+    namespace gaps {
+        /// Fixed sequences are precomputed up to this gap, enough for 10^12 elements.
+        constexpr std::uint64_t GAP_LIMIT {std::uint64_t{1} << 40};
+
+        /// Table of up to `N` gaps in increasing order.
+        template< size_t N >
+        struct GapTable {
+            std::array<std::uint64_t, N> gaps {};
+            size_t size {0};
+
+            constexpr void push(std::uint64_t gap) {
+                gaps[size++] = gap;
+            }
+        };
+
+        /// Smallest integer not below `x` (`std::ceil` is not constexpr).
+        constexpr std::uint64_t ceil_to_int(double x) {
+            auto i {static_cast<std::uint64_t>(x)};
+            return x > static_cast<double>(i) ? i + 1 : i;
+        }
+
+        /// Ciura (2001): 1, 4, 10, 23, 57, 132, 301, 701, 1750, extended by h = floor(2.25 h).
+        constexpr GapTable<64> make_ciura() {
+            GapTable<64> table;
+            for (auto gap : {1, 4, 10, 23, 57, 132, 301, 701, 1750})
+                table.push(gap);
+            while (table.gaps[table.size - 1] * 9 / 4 < GAP_LIMIT)
+                table.push(table.gaps[table.size - 1] * 9 / 4);
+            return table;
+        }
+
+        /// Tokuda (1992): h_k = ceil(h'_k), with h'_1 = 1 and h'_k = 2.25 h'_(k-1) + 1.
+        constexpr GapTable<64> make_tokuda() {
+            GapTable<64> table;
+            for (double h {1}; ceil_to_int(h) < GAP_LIMIT; h = 2.25 * h + 1)
+                table.push(ceil_to_int(h));
+            return table;
+        }
+
+        /// Sedgewick (1986): 1, then 4^k + 3 2^(k-1) + 1 for k >= 1.
+        constexpr GapTable<64> make_sedgewick() {
+            GapTable<64> table;
+            table.push(1);
+            for (std::uint64_t k {1}; (std::uint64_t{1} << 2 * k) < GAP_LIMIT; k++)
+                table.push((std::uint64_t{1} << 2 * k) + 3 * (std::uint64_t{1} << (k - 1)) + 1);
+            return table;
+        }
+
+        /// Pratt (1971): every 2^p 3^q, in increasing order (merged as in Hamming's problem).
+        constexpr GapTable<1024> make_pratt() {
+            GapTable<1024> table;
+            table.push(1);
+            size_t by_2 {0}, by_3 {0};
+            while (true) {
+                auto next {std::min(table.gaps[by_2] * 2, table.gaps[by_3] * 3)};
+                if (next >= GAP_LIMIT)
+                    break;
+                table.push(next);
+                if (next == table.gaps[by_2] * 2)
+                    by_2++;
+                if (next == table.gaps[by_3] * 3)
+                    by_3++;
+            }
+            return table;
+        }
+
+        /// Frank and Lazarus (1960): 2 floor(n / 2^(k+1)) + 1 for k = 1, 2, ... down to 1.
+        struct FrankLazarus {
+            static GapTable<64> table(std::uint64_t n) {
+                GapTable<64> table;
+                // Built from 1 upwards, with shifts instead of pow(); equal gaps are kept once.
+                for (int k {62}; k >= 1; k--) {
+                    auto gap {2 * (n >> (k + 1)) + 1};
+                    if (table.size == 0 or gap > table.gaps[table.size - 1])
+                        table.push(gap);
+                }
+                return table;
+            }
+        };
+
+        struct Ciura {
+            static constexpr GapTable<64> TABLE {make_ciura()};
+            static const GapTable<64>& table(std::uint64_t) { return TABLE; }
+        };
+
+        struct Tokuda {
+            static constexpr GapTable<64> TABLE {make_tokuda()};
+            static const GapTable<64>& table(std::uint64_t) { return TABLE; }
+        };
+
+        struct Sedgewick {
+            static constexpr GapTable<64> TABLE {make_sedgewick()};
+            static const GapTable<64>& table(std::uint64_t) { return TABLE; }
+        };
+
+        struct Pratt {
+            static constexpr GapTable<1024> TABLE {make_pratt()};
+            static const GapTable<1024>& table(std::uint64_t) { return TABLE; }
+        };
+    };
+
     /**
      * @brief Applies shell sort on the range [first, last)
      *
+     * The gap sequence is a compile-time policy from `sa::gaps` (`FrankLazarus`, the
+     * default, `Ciura`, `Tokuda`, `Sedgewick` or `Pratt`) whose gaps are precomputed in a
+     * table; each pass is an insertion sort over elements `gap` positions apart. No extra
+     * memory is used.
+     *
      * @tparam RandomIt iterator type
      * @tparam Compare type of predicate to compare objects
+     * @tparam GapPolicy type from `sa::gaps` whose `table(n)` gives the gaps in increasing order
      * @param first iterator to the beggining of the range to be sorted
      * @param last iterator to the position after the end of the range to be sorted
      * @param cmp predicate that returns true if the first argument is less than the second 
      */
-    template< typename RandomIt, typename Compare >
+    template< typename RandomIt, typename Compare, typename GapPolicy = gaps::FrankLazarus >
     void shell(RandomIt first, RandomIt last, Compare cmp){
         auto n {std::distance(first, last)};
+        const auto& table {GapPolicy::table(n)};
 
-        // k will be incremented at each iteraction,
-        // and the gap will be 2 * floor(n / 2^(k + 1)) + 1 at each iteraction, until it is 1
-        int k {1};
-        int gap;
-        do {
-            gap = 2 * floor(n / pow(2, k + 1)) + 1;
-
-            for (int i {gap}; i < n; i++) {
+        // Largest gap smaller than n first, down to 1.
+        auto g {table.size};
+        while (g > 0 and table.gaps[g - 1] >= static_cast<std::uint64_t>(n))
+            g--;
+        while (g-- > 0) {
+            auto gap {static_cast<std::ptrdiff_t>(table.gaps[g])};
+            for (auto i {gap}; i < n; i++) {
                 // uses insertion sort with a step of gap
-                auto aux = first[i];
-                int j {i};
+                auto aux {std::move(first[i])};
+                auto j {i};
                 // iterates from i to gap, decreasing at a step of gap
                 // and until the value is greater than aux
                 while (j >= gap and cmp(aux, first[j - gap])) {
-                    first[j] = first[j - gap];
+                    first[j] = std::move(first[j - gap]);
                     j -= gap;
                 }
-                first[j] = aux;
+                first[j] = std::move(aux);
             }
-
-            k++;
-        } while (gap > 1);
+        }
     }
     //}}} SHELL SORT
 
@@ -215,110 +578,2139 @@ namespace sa { // sa = sorting algorithms
         auto size_L {size / 2};
         auto size_R {size - size_L};
 
-        auto temp = *first;
-        using ValueType = decltype(temp);
+        using ValueType = typename std::iterator_traits<RandomIt>::value_type;
 
-        // Creates two temp arrays to store the two sorted ranges
-        ValueType* range_L = new ValueType[size_L];
-        ValueType* range_R = new ValueType[size_R];
+        // Moves the two sorted ranges into temp arrays
+        vector<ValueType> range_L(std::make_move_iterator(first), std::make_move_iterator(mid));
+        vector<ValueType> range_R(std::make_move_iterator(mid), std::make_move_iterator(last));
 
-        // Copies the values of the two ranges to the arrays
-        std::copy(first, mid, range_L);
-        std::copy(mid, last, range_R);
-
-        auto i {0};
-        auto j {0};
+        decltype(size) i {0};
+        decltype(size) j {0};
         // Itereates over the two arrays, putting the values back to the original range in the right order
         while (i < size_L && j < size_R) {
             if (cmp(range_L[i], range_R[j])) {
-                *first = range_L[i];
+                *first = std::move(range_L[i]);
                 i++;
             } else {
-                *first = range_R[j];
+                *first = std::move(range_R[j]);
                 j++;
             }
             first++;
         }
 
-        // If the there was any values left in any of the arrays, copies them to the end of the original range
+        // If the there was any values left in any of the arrays, moves them to the end of the original range
         if (i < size_L)
-            std::copy(&range_L[i], &range_L[size_L], first);
+            std::move(range_L.begin() + i, range_L.end(), first);
         else if (j < size_R)
-            std::copy(&range_R[j], &range_R[size_R], first);
-
-        delete [] range_L;
-        delete [] range_R;
+            std::move(range_R.begin() + j, range_R.end(), first);
     }
     //}}} MERGE SORT
 
-    //{{{ QUICK SORT
-    /*!
-     * Partition reorders the elements in the range [first;last) in such a way that
-     * all elements **less** than the pivot appear before the pivot, and all elements
-     * equal or greater than the pivot appear after the pivot.
+    //{{{ BUFFERED MERGE SORT
+    /// Runs of at most this many elements are sorted by `small_sort` instead of merged.
+    constexpr std::ptrdiff_t MERGE_INSERTION_CUTOFF {24};
+
+    /**
+     * @brief Stably merges the sorted ranges [a, a_last) and [b, b_last) into `out`,
+     * moving the elements. Ties are taken from the first range.
      *
-     * Any relative order among elements of the array might not be preserved.
+     * @return Iterator to the position after the last element written.
+     */
+    template< typename InIt, typename OutIt, typename Compare >
+    OutIt merge_runs(InIt a, InIt a_last, InIt b, InIt b_last, OutIt out, Compare cmp) {
+        while (a != a_last and b != b_last) {
+            if (cmp(*b, *a))
+                *out++ = std::move(*b++);
+            else
+                *out++ = std::move(*a++);
+        }
+        out = std::move(a, a_last, out);
+        return std::move(b, b_last, out);
+    }
+
+    /**
+     * @brief Sorts the `n` elements at `data`, leaving the result in `data` when `into_data`
+     * is true or in `scratch` otherwise. Each level merges from one buffer into the other,
+     * so no element is copied back and nothing is allocated.
+     */
+    template< typename RandomIt, typename BufferIt, typename Compare >
+    void merge_sort_to(RandomIt data, BufferIt scratch, std::ptrdiff_t n, bool into_data, Compare cmp) {
+        if (n <= MERGE_INSERTION_CUTOFF) {
+            small_sort(data, data + n, cmp);
+            if (not into_data)
+                std::move(data, data + n, scratch);
+            return;
+        }
+        auto half {n / 2};
+        // The halves go to the buffer we are *not* targeting and are merged back from there.
+        merge_sort_to(data, scratch, half, not into_data, cmp);
+        merge_sort_to(data + half, scratch + half, n - half, not into_data, cmp);
+        if (into_data)
+            merge_runs(scratch, scratch + half, scratch + half, scratch + n, data, cmp);
+        else
+            merge_runs(data, data + half, data + half, data + n, scratch, cmp);
+    }
+
+    /**
+     * @brief Applies a top-down merge sort on the range [first, last) using a single
+     * scratch buffer supplied by the client.
      *
-     * By **less** we mean a _strict order_ binary relation among the elements we
-     * wantt to partition.
+     * The recursion ping-pongs between the range and the buffer, and runs shorter than
+     * `MERGE_INSERTION_CUTOFF` are sorted by `small_sort`. The sort is stable.
      *
-     * \note We assume the pivot is a valid iterator in [first; last).
+     * @tparam RandomIt iterator type
+     * @tparam BufferIt iterator type of the scratch buffer
+     * @tparam Compare type of predicate to compare objects
+     * @param first iterator to the beggining of the range to be sorted
+     * @param last iterator to the position after the end of the range to be sorted
+     * @param scratch beggining of a buffer with room for at least `last - first` elements
+     * @param cmp predicate that returns true if the first argument is less than the second
+     */
+    template< typename RandomIt, typename BufferIt, typename Compare >
+    void merge_buffered(RandomIt first, RandomIt last, BufferIt scratch, Compare cmp){
+        merge_sort_to(first, scratch, std::distance(first, last), true, cmp);
+    }
+
+    /**
+     * Top-down buffered merge sort that allocates its scratch buffer once. The elements
+     * are moved into the buffer and sorted back into the range, so no element is copied
+     * and `ValueType` needs neither a copy nor a default constructor.
+     */
+    template< typename RandomIt, typename Compare >
+    void merge_buffered(RandomIt first, RandomIt last, Compare cmp){
+        using ValueType = typename std::iterator_traits<RandomIt>::value_type;
+        vector<ValueType> scratch(std::make_move_iterator(first), std::make_move_iterator(last));
+        merge_sort_to(scratch.begin(), first, std::distance(first, last), false, cmp);
+    }
+
+    /// Sorts the `n` elements at `data` in runs of `MERGE_INSERTION_CUTOFF` with `small_sort`.
+    template< typename RandomIt, typename Compare >
+    void sort_runs(RandomIt data, std::ptrdiff_t n, Compare cmp) {
+        for (std::ptrdiff_t lo {0}; lo < n; lo += MERGE_INSERTION_CUTOFF)
+            small_sort(data + lo, data + std::min(lo + MERGE_INSERTION_CUTOFF, n), cmp);
+    }
+
+    /// Merges every pair of runs of `width` of the `n` elements at `src`, in order, into `dst`.
+    template< typename RandomIt, typename OutIt, typename Compare >
+    void merge_pass(RandomIt src, OutIt dst, std::ptrdiff_t n, std::ptrdiff_t width, Compare cmp) {
+        for (std::ptrdiff_t lo {0}; lo < n; lo += 2 * width) {
+            auto mid {std::min(lo + width, n)};
+            auto hi {std::min(lo + 2 * width, n)};
+            dst = merge_runs(src + lo, src + mid, src + mid, src + hi, dst, cmp);
+        }
+    }
+
+    /**
+     * Merge passes of doubling width from `width` on, the first from `a` into `b`, then
+     * back and forth. Returns true when the result is in `b`: after an odd number of passes.
+     */
+    template< typename RandomIt, typename BufferIt, typename Compare >
+    bool merge_passes(RandomIt a, BufferIt b, std::ptrdiff_t n, std::ptrdiff_t width, Compare cmp) {
+        bool in_b {false};
+        for (; width < n; width *= 2) {
+            if (in_b)
+                merge_pass(b, a, n, width, cmp);
+            else
+                merge_pass(a, b, n, width, cmp);
+            in_b = not in_b;
+        }
+        return in_b;
+    }
+
+    /**
+     * @brief Applies a bottom-up (iterative) merge sort on the range [first, last) using a
+     * single scratch buffer supplied by the client.
      *
-     * @param first The first element in the range we want to reorder.
-     * @param last Past the last element in the range we want to reorder.
-     * @param pivot Location of the pivot element we need to partition the array.
-     * @param cmp A comparison function that returns true if the first parameter is **less** than the second.
-     * @return An iterator to the new pivot location within the range.
+     * Runs of `MERGE_INSERTION_CUTOFF` elements are first sorted by `small_sort`, then
+     * merged in passes of doubling width that alternate between the range and the buffer.
+     * There is no recursion. The sort is stable.
+     *
+     * @tparam RandomIt iterator type
+     * @tparam BufferIt iterator type of the scratch buffer
+     * @tparam Compare type of predicate to compare objects
+     * @param first iterator to the beggining of the range to be sorted
+     * @param last iterator to the position after the end of the range to be sorted
+     * @param scratch beggining of a buffer with room for at least `last - first` elements
+     * @param cmp predicate that returns true if the first argument is less than the second
      */
-    template<class FwrdIt, class Compare>
-    FwrdIt partition(FwrdIt first, FwrdIt last, FwrdIt pivot, Compare cmp) {
-        std::iter_swap(pivot, last - 1);
-        // Slow/fast approach: operating within the own range.
-        auto slow {first};
-        auto fast {first};
+    template< typename RandomIt, typename BufferIt, typename Compare >
+    void merge_bottom_up(RandomIt first, RandomIt last, BufferIt scratch, Compare cmp){
+        auto n {std::distance(first, last)};
+        sort_runs(first, n, cmp);
+        if (merge_passes(first, scratch, n, MERGE_INSERTION_CUTOFF, cmp))
+            std::move(scratch, scratch + n, first);
+    }
 
-        // Traverse range, rearranging the elements
-        while (fast != last) {
-            // Move smallest to the front region of the array.
-            if (cmp(*fast, *pivot)) {
-                std::iter_swap(fast, slow);
-                slow++;
-            }
-            // Advance frontier..
-            fast++;
+    /**
+     * Bottom-up merge sort that allocates its scratch buffer once. The parity of the number
+     * of passes decides where the runs start so that the last pass lands in the range: with
+     * an even number they are sorted in the range and the first pass fills the buffer,
+     * with an odd one the elements are moved to the buffer and sorted there. No element is
+     * copied, and `ValueType` needs neither a copy nor a default constructor.
+     */
+    template< typename RandomIt, typename Compare >
+    void merge_bottom_up(RandomIt first, RandomIt last, Compare cmp){
+        using ValueType = typename std::iterator_traits<RandomIt>::value_type;
+        auto n {std::distance(first, last)};
+        std::ptrdiff_t passes {0};
+        for (auto width {MERGE_INSERTION_CUTOFF}; width < n; width *= 2)
+            passes++;
+        if (passes == 0) {
+            small_sort(first, last, cmp);
+            return;
         }
+        vector<ValueType> scratch;
+        if (passes % 2 == 0) {
+            scratch.reserve(n);
+            sort_runs(first, n, cmp);
+            merge_pass(first, std::back_inserter(scratch), n, MERGE_INSERTION_CUTOFF, cmp);
+            merge_passes(scratch.begin(), first, n, 2 * MERGE_INSERTION_CUTOFF, cmp);
+        } else {
+            scratch.assign(std::make_move_iterator(first), std::make_move_iterator(last));
+            sort_runs(scratch.begin(), n, cmp);
+            merge_passes(scratch.begin(), first, n, MERGE_INSERTION_CUTOFF, cmp);
+        }
+    }
+    //}}} BUFFERED MERGE SORT
 
-        // We need a final swap, so that the pivot end up in its final position
-        // in the sorted array.
-        std::iter_swap(slow, pivot);
+    //{{{ BOUNDED MERGE SORT
+    /// Merges [first, mid) and [mid, last) by moving the first range out to `buffer` and merging from the front.
+    template< typename RandomIt, typename BufferIt, typename Compare >
+    void merge_from_front(RandomIt first, RandomIt mid, RandomIt last, BufferIt buffer, Compare cmp) {
+        auto buffer_last {std::move(first, mid, buffer)};
+        while (buffer != buffer_last and mid != last) {
+            if (cmp(*mid, *buffer))
+                *first++ = std::move(*mid++);
+            else
+                *first++ = std::move(*buffer++);
+        }
+        std::move(buffer, buffer_last, first); // what is left of [mid, last) is in place
+    }
 
-        return slow;
+    /// Merges [first, mid) and [mid, last) by moving the second range out to `buffer` and merging from the back.
+    template< typename RandomIt, typename BufferIt, typename Compare >
+    void merge_from_back(RandomIt first, RandomIt mid, RandomIt last, BufferIt buffer, Compare cmp) {
+        auto buffer_last {std::move(mid, last, buffer)};
+        while (buffer != buffer_last and first != mid) {
+            if (cmp(*(buffer_last - 1), *(mid - 1)))
+                *--last = std::move(*--mid);
+            else
+                *--last = std::move(*--buffer_last);
+        }
+        std::move_backward(buffer, buffer_last, last); // what is left of [first, mid) is in place
     }
-    /// Quick sort implementation.
-    template<typename RandomIt, typename Compare>
-    void quick(RandomIt first, RandomIt last, Compare cmp) {
-        auto size {std::distance(first, last)};
 
-        if (size <= 1)
+    /**
+     * @brief Swaps the ranges [first, mid) and [mid, last) through `buffer` when the shorter
+     * one fits in its `budget` elements, with `std::rotate` otherwise.
+     * @return Iterator to the new position of `*first`.
+     */
+    template< typename RandomIt, typename BufferIt >
+    RandomIt rotate_in_budget(RandomIt first, RandomIt mid, RandomIt last, BufferIt buffer, std::ptrdiff_t budget) {
+        auto len_1 {mid - first};
+        auto len_2 {last - mid};
+        if (len_1 <= len_2 and len_1 <= budget) {
+            auto buffer_last {std::move(first, mid, buffer)};
+            auto moved {std::move(mid, last, first)};
+            std::move(buffer, buffer_last, moved);
+            return moved;
+        }
+        if (len_2 <= budget) {
+            auto buffer_last {std::move(mid, last, buffer)};
+            std::move_backward(first, mid, last);
+            return std::move(buffer, buffer_last, first);
+        }
+        return std::rotate(first, mid, last);
+    }
+
+    /**
+     * @brief Stably merges the sorted ranges [first, mid) and [mid, last) with a scratch
+     * buffer of `budget` elements, which may be zero.
+     *
+     * The elements already in place at both ends are skipped first (two binary searches).
+     * When the shorter of the remaining runs fits in the buffer, it is moved there and
+     * merged back in one linear pass. Otherwise the longer run is cut at its middle, the
+     * other at the matching position, the two inner pieces are rotated past each other
+     * and each side is merged on its own, as `std::inplace_merge` does without memory:
+     * with no buffer at all this costs O(n log n) moves per merge, and any budget cuts
+     * the recursion short as soon as the pieces fit.
+     */
+    template< typename RandomIt, typename BufferIt, typename Compare >
+    void merge_in_budget(RandomIt first, RandomIt mid, RandomIt last, BufferIt buffer, std::ptrdiff_t budget, Compare cmp) {
+        for (;;) {
+            if (first == mid or mid == last)
+                return;
+            // Ties stay in order: equal elements of the first run go before those of the second.
+            first = std::upper_bound(first, mid, *mid, cmp);
+            last = std::lower_bound(mid, last, *(mid - 1), cmp);
+            auto len_1 {mid - first};
+            auto len_2 {last - mid};
+            if (len_1 == 0 or len_2 == 0)
+                return;
+            if (len_1 <= len_2 and len_1 <= budget) {
+                merge_from_front(first, mid, last, buffer, cmp);
+                return;
+            }
+            if (len_2 <= budget) {
+                merge_from_back(first, mid, last, buffer, cmp);
+                return;
+            }
+            if (len_1 + len_2 == 2) { // the ends were skipped, so the two are out of order
+                std::iter_swap(first, mid);
+                return;
+            }
+            RandomIt cut_1, cut_2;
+            if (len_1 > len_2) {
+                cut_1 = first + len_1 / 2;
+                cut_2 = std::lower_bound(mid, last, *cut_1, cmp);
+            } else {
+                cut_2 = mid + len_2 / 2;
+                cut_1 = std::upper_bound(first, mid, *cut_2, cmp);
+            }
+            auto new_mid {rotate_in_budget(cut_1, mid, cut_2, buffer, budget)};
+            // Recurses into the smaller side and loops on the larger one, so the stack stays O(log n).
+            if (new_mid - first < last - new_mid) {
+                merge_in_budget(first, cut_1, new_mid, buffer, budget, cmp);
+                first = new_mid;
+                mid = cut_2;
+            } else {
+                merge_in_budget(new_mid, cut_2, last, buffer, budget, cmp);
+                last = new_mid;
+                mid = cut_1;
+            }
+        }
+    }
+
+    /// Top-down merge sort of [first, last) whose merges use at most `budget` elements of `buffer`.
+    template< typename RandomIt, typename BufferIt, typename Compare >
+    void merge_sort_in_budget(RandomIt first, RandomIt last, BufferIt buffer, std::ptrdiff_t budget, Compare cmp) {
+        auto n {last - first};
+        if (n <= MERGE_INSERTION_CUTOFF) {
+            small_sort(first, last, cmp);
             return;
+        }
+        auto mid {first + n / 2};
+        merge_sort_in_budget(first, mid, buffer, budget, cmp);
+        merge_sort_in_budget(mid, last, buffer, budget, cmp);
+        if (cmp(*mid, *(mid - 1)))
+            merge_in_budget(first, mid, last, buffer, budget, cmp);
+    }
+
+    /**
+     * @brief Applies a stable merge sort on the range [first, last) that never uses more
+     * than `budget` elements of scratch memory.
+     *
+     * With a budget of half the range every merge is a single buffered pass; below that,
+     * merges whose runs do not fit fall back on rotations, down to a budget of zero, where
+     * the sort is fully in place and takes O(n log² n) time. The time grows smoothly as the
+     * budget shrinks, since the recursion of a merge stops as soon as its pieces fit.
+     *
+     * @tparam RandomIt iterator type
+     * @tparam BufferIt iterator type of the scratch buffer
+     * @tparam Compare type of predicate to compare objects
+     * @param first iterator to the beggining of the range to be sorted
+     * @param last iterator to the position after the end of the range to be sorted
+     * @param scratch beggining of a buffer with room for `budget` elements (unused when `budget` is zero)
+     * @param budget scratch elements the sort may use; more than half the range is never used
+     * @param cmp predicate that returns true if the first argument is less than the second
+     */
+    template< typename RandomIt, typename BufferIt, typename Compare >
+    void merge_bounded(RandomIt first, RandomIt last, BufferIt scratch, std::ptrdiff_t budget, Compare cmp){
+        merge_sort_in_budget(first, last, scratch, std::max<std::ptrdiff_t>(budget, 0), cmp);
+    }
 
-        // Let us apply the Lamuto's median-of-three pivot selection strategy
-        // to avoid segfault (stack overflow) in case the array is already
-        // sorted.
+    /**
+     * Stable merge sort that allocates a scratch buffer of `budget` elements, at most half
+     * the range. The buffer slots are taken from the range by moving its first elements
+     * out and back, so `ValueType` needs neither a copy nor a default constructor.
+     */
+    template< typename RandomIt, typename Compare >
+    void merge_bounded(RandomIt first, RandomIt last, std::ptrdiff_t budget, Compare cmp){
+        using ValueType = typename std::iterator_traits<RandomIt>::value_type;
+        budget = std::clamp<std::ptrdiff_t>(budget, 0, std::distance(first, last) / 2);
+        vector<ValueType> scratch(std::make_move_iterator(first), std::make_move_iterator(first + budget));
+        std::move(scratch.begin(), scratch.end(), first);
+        merge_sort_in_budget(first, last, scratch.begin(), budget, cmp);
+    }
+    //}}} BOUNDED MERGE SORT
 
-        auto mid {first + size / 2 };
-        if (cmp(*(last - 1), *first))
-            std::iter_swap(last - 1, first);
-        if (cmp(*mid, *first))
-            std::iter_swap(mid, first);
-        if (cmp(*mid, *(last - 1)))
-            std::iter_swap(mid, last - 1); // To ensure the median is the last value
-        
-        auto pivot {partition(first, last, last - 1, cmp)};
+    //{{{ TIMSORT
+    /// Ranges shorter than this are sorted by binary insertion sort alone.
+    constexpr std::ptrdiff_t TIMSORT_MIN_MERGE {64};
+    /// Initial number of consecutive wins that switches a merge into galloping mode.
+    constexpr std::ptrdiff_t TIMSORT_MIN_GALLOP {7};
+
+    /**
+     * @brief Finds where `key` goes in the sorted [first, first + n), before any equal
+     * element (as `std::lower_bound`), searching exponentially away from `hint` first and
+     * then binary searching the bracketed interval.
+     */
+    template< typename RandomIt, typename T, typename Compare >
+    std::ptrdiff_t gallop_left(const T& key, RandomIt first, std::ptrdiff_t n, std::ptrdiff_t hint, Compare cmp) {
+        std::ptrdiff_t last_ofs {0}, ofs {1};
+        if (cmp(first[hint], key)) {
+            // Gallop right until first[hint + last_ofs] < key <= first[hint + ofs].
+            auto max_ofs {n - hint};
+            while (ofs < max_ofs and cmp(first[hint + ofs], key)) {
+                last_ofs = ofs;
+                ofs = 2 * ofs + 1;
+            }
+            ofs = std::min(ofs, max_ofs);
+            last_ofs += hint;
+            ofs += hint;
+        } else {
+            // Gallop left until first[hint - ofs] < key <= first[hint - last_ofs].
+            auto max_ofs {hint + 1};
+            while (ofs < max_ofs and not cmp(first[hint - ofs], key)) {
+                last_ofs = ofs;
+                ofs = 2 * ofs + 1;
+            }
+            ofs = std::min(ofs, max_ofs);
+            auto old_last {last_ofs};
+            last_ofs = hint - ofs;
+            ofs = hint - old_last;
+        }
+        return std::lower_bound(first + (last_ofs + 1), first + ofs, key, cmp) - first;
+    }
 
-        quick(first, pivot, cmp);
-        quick(pivot + 1, last, cmp);
+    /// Same as `gallop_left`, but `key` goes after any equal element (as `std::upper_bound`).
+    template< typename RandomIt, typename T, typename Compare >
+    std::ptrdiff_t gallop_right(const T& key, RandomIt first, std::ptrdiff_t n, std::ptrdiff_t hint, Compare cmp) {
+        std::ptrdiff_t last_ofs {0}, ofs {1};
+        if (cmp(key, first[hint])) {
+            // Gallop left until first[hint - ofs] <= key < first[hint - last_ofs].
+            auto max_ofs {hint + 1};
+            while (ofs < max_ofs and cmp(key, first[hint - ofs])) {
+                last_ofs = ofs;
+                ofs = 2 * ofs + 1;
+            }
+            ofs = std::min(ofs, max_ofs);
+            auto old_last {last_ofs};
+            last_ofs = hint - ofs;
+            ofs = hint - old_last;
+        } else {
+            // Gallop right until first[hint + last_ofs] <= key < first[hint + ofs].
+            auto max_ofs {n - hint};
+            while (ofs < max_ofs and not cmp(key, first[hint + ofs])) {
+                last_ofs = ofs;
+                ofs = 2 * ofs + 1;
+            }
+            ofs = std::min(ofs, max_ofs);
+            last_ofs += hint;
+            ofs += hint;
+        }
+        return std::upper_bound(first + (last_ofs + 1), first + ofs, key, cmp) - first;
     }
-    //}}} QUICK SORT
+
+    /**
+     * @brief Binary insertion sort of [first, last) when [first, start) is already sorted.
+     * Each element is placed after the equal ones already in place, so it is stable.
+     */
+    template< typename RandomIt, typename Compare >
+    void binary_insertion(RandomIt first, RandomIt last, RandomIt start, Compare cmp) {
+        for (; start != last; ++start) {
+            auto pivot {std::move(*start)};
+            auto position {std::upper_bound(first, start, pivot, cmp)};
+            std::move_backward(position, start, start + 1);
+            *position = std::move(pivot);
+        }
+    }
+
+    /**
+     * @brief Length of the run that starts at `first`: the longest non-decreasing prefix, or
+     * the longest strictly decreasing one, which is reversed in place (strictness keeps the
+     * reversal stable).
+     */
+    template< typename RandomIt, typename Compare >
+    std::ptrdiff_t count_run(RandomIt first, RandomIt last, Compare cmp) {
+        auto run_end {first + 1};
+        if (run_end == last)
+            return 1;
+        if (cmp(*run_end, *first)) {
+            while (++run_end != last and cmp(*run_end, *(run_end - 1)));
+            std::reverse(first, run_end);
+        } else {
+            while (++run_end != last and not cmp(*run_end, *(run_end - 1)));
+        }
+        return run_end - first;
+    }
+
+    /// Minimum run length: in [32, 64], such that n / min_run is a power of two or just below.
+    inline std::ptrdiff_t timsort_min_run(std::ptrdiff_t n) {
+        std::ptrdiff_t remainder {0};
+        while (n >= TIMSORT_MIN_MERGE) {
+            remainder |= n & 1;
+            n >>= 1;
+        }
+        return n + remainder;
+    }
+
+    /// State of one timsort call: the stack of pending runs and the merge buffer.
+    template< typename RandomIt, typename Compare >
+    class TimSort {
+        using ValueType = typename std::iterator_traits<RandomIt>::value_type;
+
+        struct Run {
+            std::ptrdiff_t base;
+            std::ptrdiff_t length;
+        };
+
+        RandomIt first;
+        Compare cmp;
+        vector<Run> runs;
+        vector<ValueType> buffer;
+        std::ptrdiff_t min_gallop {TIMSORT_MIN_GALLOP};
+
+        /// Merges [base1, base1 + len1) and the run right after it, with len1 <= len2.
+        void merge_low(std::ptrdiff_t base1, std::ptrdiff_t len1, std::ptrdiff_t base2, std::ptrdiff_t len2) {
+            buffer.clear();
+            buffer.insert(buffer.end(), std::make_move_iterator(first + base1), std::make_move_iterator(first + base1 + len1));
+            auto tmp {buffer.begin()};
+            std::ptrdiff_t cursor1 {0};          // into the buffer (first run)
+            auto cursor2 {base2};                // into the range (second run)
+            auto end2 {base2 + len2};
+            auto dest {base1};
+
+            while (cursor1 < len1 and cursor2 < end2) {
+                // One element at a time, until one run wins `min_gallop` times in a row.
+                std::ptrdiff_t count1 {0}, count2 {0};
+                while (cursor1 < len1 and cursor2 < end2 and count1 < min_gallop and count2 < min_gallop) {
+                    if (cmp(first[cursor2], tmp[cursor1])) {
+                        first[dest++] = std::move(first[cursor2++]);
+                        count2++;
+                        count1 = 0;
+                    } else {
+                        first[dest++] = std::move(tmp[cursor1++]);
+                        count1++;
+                        count2 = 0;
+                    }
+                }
+                // Galloping: copy whole stretches found by exponential search.
+                while (cursor1 < len1 and cursor2 < end2) {
+                    auto k1 {gallop_right(first[cursor2], tmp + cursor1, len1 - cursor1, 0, cmp)};
+                    std::move(tmp + cursor1, tmp + cursor1 + k1, first + dest);
+                    dest += k1;
+                    cursor1 += k1;
+                    if (cursor1 == len1)
+                        break;
+                    auto k2 {gallop_left(tmp[cursor1], first + cursor2, end2 - cursor2, 0, cmp)};
+                    std::move(first + cursor2, first + cursor2 + k2, first + dest);
+                    dest += k2;
+                    cursor2 += k2;
+                    if (cursor2 == end2)
+                        break;
+                    first[dest++] = std::move(tmp[cursor1++]);
+                    if (k1 < TIMSORT_MIN_GALLOP and k2 < TIMSORT_MIN_GALLOP) {
+                        min_gallop++;
+                        break;
+                    }
+                    min_gallop -= min_gallop > 1;
+                }
+            }
+            // What is left of the second run is already in place.
+            std::move(tmp + cursor1, tmp + len1, first + dest);
+        }
+
+        /// Merges [base1, base1 + len1) and the run right after it, with len1 > len2, backwards.
+        void merge_high(std::ptrdiff_t base1, std::ptrdiff_t len1, std::ptrdiff_t base2, std::ptrdiff_t len2) {
+            buffer.clear();
+            buffer.insert(buffer.end(), std::make_move_iterator(first + base2), std::make_move_iterator(first + base2 + len2));
+            auto tmp {buffer.begin()};
+            auto cursor1 {base1 + len1};         // one past, into the range (first run)
+            auto cursor2 {len2};                 // one past, into the buffer (second run)
+            auto dest {base2 + len2};
+
+            while (cursor1 > base1 and cursor2 > 0) {
+                std::ptrdiff_t count1 {0}, count2 {0};
+                while (cursor1 > base1 and cursor2 > 0 and count1 < min_gallop and count2 < min_gallop) {
+                    if (cmp(tmp[cursor2 - 1], first[cursor1 - 1])) {
+                        first[--dest] = std::move(first[--cursor1]);
+                        count1++;
+                        count2 = 0;
+                    } else {
+                        first[--dest] = std::move(tmp[--cursor2]);
+                        count2++;
+                        count1 = 0;
+                    }
+                }
+                while (cursor1 > base1 and cursor2 > 0) {
+                    // Elements of the first run greater than the last of the buffer go last.
+                    auto n1 {cursor1 - base1};
+                    auto k1 {n1 - gallop_right(tmp[cursor2 - 1], first + base1, n1, n1 - 1, cmp)};
+                    std::move_backward(first + (cursor1 - k1), first + cursor1, first + dest);
+                    dest -= k1;
+                    cursor1 -= k1;
+                    if (cursor1 == base1)
+                        break;
+                    // Buffered elements not less than the last of the first run go next.
+                    auto k2 {cursor2 - gallop_left(first[cursor1 - 1], tmp, cursor2, cursor2 - 1, cmp)};
+                    std::move_backward(tmp + (cursor2 - k2), tmp + cursor2, first + dest);
+                    dest -= k2;
+                    cursor2 -= k2;
+                    if (cursor2 == 0)
+                        break;
+                    first[--dest] = std::move(first[--cursor1]);
+                    if (k1 < TIMSORT_MIN_GALLOP and k2 < TIMSORT_MIN_GALLOP) {
+                        min_gallop++;
+                        break;
+                    }
+                    min_gallop -= min_gallop > 1;
+                }
+            }
+            // What is left of the first run is already in place.
+            std::move_backward(tmp, tmp + cursor2, first + dest);
+        }
+
+        /// Merges the runs at positions i and i + 1 of the stack.
+        void merge_at(size_t i) {
+            auto base1 {runs[i].base}, len1 {runs[i].length};
+            auto base2 {runs[i + 1].base}, len2 {runs[i + 1].length};
+            runs[i].length = len1 + len2;
+            runs.erase(runs.begin() + i + 1);
+
+            // Elements of the first run not greater than the head of the second are in place.
+            auto k {gallop_right(first[base2], first + base1, len1, 0, cmp)};
+            base1 += k;
+            len1 -= k;
+            if (len1 == 0)
+                return;
+            // So are the elements of the second run not less than the tail of the first.
+            len2 = gallop_left(first[base1 + len1 - 1], first + base2, len2, len2 - 1, cmp);
+            if (len2 == 0)
+                return;
+            if (len1 <= len2)
+                merge_low(base1, len1, base2, len2);
+            else
+                merge_high(base1, len1, base2, len2);
+        }
+
+        /**
+         * Restores the stack invariants len[i-2] > len[i-1] + len[i] and len[i-1] > len[i]
+         * on the top runs (including the run below, as fixed by de Gouw et al. in 2015),
+         * which keeps the merges balanced and the stack depth logarithmic.
+         */
+        void merge_collapse() {
+            while (runs.size() > 1) {
+                auto n {runs.size() - 2};
+                if ((n > 0 and runs[n - 1].length <= runs[n].length + runs[n + 1].length) or
+                    (n > 1 and runs[n - 2].length <= runs[n - 1].length + runs[n].length)) {
+                    if (runs[n - 1].length < runs[n + 1].length)
+                        n--;
+                } else if (runs[n].length > runs[n + 1].length) {
+                    break;
+                }
+                merge_at(n);
+            }
+        }
+
+        /// Merges every run left on the stack.
+        void merge_force_collapse() {
+            while (runs.size() > 1) {
+                auto n {runs.size() - 2};
+                if (n > 0 and runs[n - 1].length < runs[n + 1].length)
+                    n--;
+                merge_at(n);
+            }
+        }
+
+    public:
+        TimSort(RandomIt first, Compare cmp) : first{first}, cmp{cmp} {}
+
+        void sort(std::ptrdiff_t n) {
+            if (n < 2)
+                return;
+            if (n < TIMSORT_MIN_MERGE) {
+                binary_insertion(first, first + n, first + count_run(first, first + n, cmp), cmp);
+                return;
+            }
+            auto min_run {timsort_min_run(n)};
+            std::ptrdiff_t low {0};
+            while (low < n) {
+                auto length {count_run(first + low, first + n, cmp)};
+                // Short runs are extended to min_run elements with binary insertion.
+                if (length < min_run) {
+                    auto forced {std::min(min_run, n - low)};
+                    binary_insertion(first + low, first + low + forced, first + low + length, cmp);
+                    length = forced;
+                }
+                runs.push_back(Run{low, length});
+                merge_collapse();
+                low += length;
+            }
+            merge_force_collapse();
+        }
+    };
+
+    /**
+     * @brief Applies an adaptive natural merge sort (timsort) on the range [first, last)
+     *
+     * Ascending and strictly descending runs are detected (the latter reversed in place),
+     * short runs are extended with binary insertion, runs are merged following a balanced
+     * stack policy, and merges switch to galloping mode when one run keeps winning. Nearly
+     * sorted input takes close to linear time. The sort is stable and uses at most n / 2
+     * elements of extra memory.
+     *
+     * @tparam RandomIt iterator type
+     * @tparam Compare type of predicate to compare objects
+     * @param first iterator to the beggining of the range to be sorted
+     * @param last iterator to the position after the end of the range to be sorted
+     * @param cmp predicate that returns true if the first argument is less than the second
+     */
+    template< typename RandomIt, typename Compare >
+    void timsort(RandomIt first, RandomIt last, Compare cmp){
+        TimSort<RandomIt, Compare>{first, cmp}.sort(std::distance(first, last));
+    }
+    //}}} TIMSORT
+
+    //{{{ NETWORK SORT
+    /**
+     * @brief Sorts the range [first, last) with sorting networks.
+     *
+     * Ranges of up to `NETWORK_MAX_SIZE` (64) elements are sorted by a single network:
+     * in SIMD registers (AVX2 or SSE4, picked at runtime) for `int32`, `int64` and `float`
+     * keys under `std::less`, and by a branch-free scalar network for any other type or
+     * comparator. Longer ranges are sorted by `merge_bottom_up`, whose leaves use the
+     * same kernels.
+     *
+     * @tparam RandomIt iterator type
+     * @tparam Compare type of predicate to compare objects
+     * @param first iterator to the beggining of the range to be sorted
+     * @param last iterator to the position after the end of the range to be sorted
+     * @param cmp predicate that returns true if the first argument is less than the second
+     */
+    template< typename RandomIt, typename Compare >
+    void network_sort(RandomIt first, RandomIt last, Compare cmp){
+        if (std::distance(first, last) <= NETWORK_MAX_SIZE)
+            network_sort_block(first, last, cmp);
+        else
+            merge_bottom_up(first, last, cmp);
+    }
+    //}}} NETWORK SORT
+
+    //{{{ PARALLEL MERGE SORT
+    /// Below this many elements the parallel merge sort falls back to the sequential `merge`.
+    constexpr std::ptrdiff_t PARALLEL_SORT_CUTOFF {1 << 13};
+    /// Below this many output elements a merge is not split any further.
+    constexpr std::ptrdiff_t PARALLEL_MERGE_CUTOFF {1 << 15};
+
+    /**
+     * @brief Co-ranking (merge path) step: finds how many elements of [a, a + n_a) come
+     * before output position `k` when [a, a + n_a) and [b, b + n_b) are stably merged.
+     *
+     * The remaining `k - i` elements come from the second range. Ties go to the first
+     * range, as in `std::merge`.
+     *
+     * @return The number `i` of elements taken from the first range.
+     */
+    template< typename RandomIt1, typename RandomIt2, typename Compare >
+    std::ptrdiff_t co_rank(std::ptrdiff_t k, RandomIt1 a, std::ptrdiff_t n_a,
+                           RandomIt2 b, std::ptrdiff_t n_b, Compare cmp) {
+        auto lo {std::max<std::ptrdiff_t>(0, k - n_b)};
+        auto hi {std::min(k, n_a)};
+        while (lo < hi) {
+            auto i {lo + (hi - lo) / 2};
+            auto j {k - i};
+            // a[i] must go before b[j - 1] (a[i] <= b[j - 1]): take more from the first range.
+            if (j > 0 and not cmp(b[j - 1], a[i]))
+                lo = i + 1;
+            else
+                hi = i;
+        }
+        return lo;
+    }
+
+    /**
+     * @brief Stably merges [a, a + n_a) and [b, b + n_b) into `out`, splitting the output
+     * into chunks whose boundaries are found with `co_rank`, so the chunks merge in parallel.
+     */
+    template< typename InIt, typename OutIt, typename Compare >
+    void parallel_merge_ranges(InIt a, std::ptrdiff_t n_a, InIt b, std::ptrdiff_t n_b,
+                               OutIt out, Compare cmp, ThreadPool& pool) {
+        auto total {n_a + n_b};
+        if (total <= PARALLEL_MERGE_CUTOFF or pool.size() == 1) {
+            std::merge(std::make_move_iterator(a), std::make_move_iterator(a + n_a),
+                       std::make_move_iterator(b), std::make_move_iterator(b + n_b), out, cmp);
+            return;
+        }
+        auto n_chunks {std::min<std::ptrdiff_t>(4 * pool.size(), total / PARALLEL_MERGE_CUTOFF + 1)};
+        // Every split is found before any chunk starts moving elements out of the inputs.
+        vector<std::ptrdiff_t> splits(n_chunks + 1);
+        for (std::ptrdiff_t c {0}; c <= n_chunks; c++)
+            splits[c] = co_rank(total * c / n_chunks, a, n_a, b, n_b, cmp);
+        TaskGroup group{pool};
+        for (std::ptrdiff_t c {0}; c < n_chunks; c++) {
+            group.run([=, &splits] {
+                auto k_begin {total * c / n_chunks};
+                auto k_end {total * (c + 1) / n_chunks};
+                auto i_begin {splits[c]};
+                auto i_end {splits[c + 1]};
+                auto j_begin {k_begin - i_begin};
+                auto j_end {k_end - i_end};
+                std::merge(std::make_move_iterator(a + i_begin), std::make_move_iterator(a + i_end),
+                           std::make_move_iterator(b + j_begin), std::make_move_iterator(b + j_end),
+                           out + k_begin, cmp);
+            });
+        }
+        group.wait();
+    }
+
+    /**
+     * @brief Sorts the `n` elements at `data`, leaving the result in `data` when `into_data`
+     * is true or in `scratch` otherwise (ping-pong between the two buffers).
+     */
+    template< typename RandomIt, typename BufferIt, typename Compare >
+    void parallel_merge_sort(RandomIt data, BufferIt scratch, std::ptrdiff_t n, bool into_data,
+                             Compare cmp, ThreadPool& pool) {
+        if (n <= PARALLEL_SORT_CUTOFF) {
+            merge_sort_to(data, scratch, n, into_data, cmp);
+            return;
+        }
+        auto half {n / 2};
+        // The halves are sorted into the buffer we are *not* targeting, then merged back.
+        {
+            TaskGroup group{pool};
+            group.run([=, &pool] { parallel_merge_sort(data, scratch, half, not into_data, cmp, pool); });
+            parallel_merge_sort(data + half, scratch + half, n - half, not into_data, cmp, pool);
+            group.wait();
+        }
+        if (into_data)
+            parallel_merge_ranges(scratch, half, scratch + half, n - half, data, cmp, pool);
+        else
+            parallel_merge_ranges(data, half, data + half, n - half, scratch, cmp, pool);
+    }
+
+    /**
+     * @brief Applies a parallel merge sort on the range [first, last)
+     *
+     * The two recursive halves run as tasks on a work-stealing pool and large merges are
+     * split with a co-ranking (merge path) step, so the last levels also run in parallel.
+     * Ranges smaller than `PARALLEL_SORT_CUTOFF` are sorted sequentially, in the same
+     * scratch buffer, as in `merge_buffered`. The sort is stable.
+     *
+     * @tparam RandomIt iterator type
+     * @tparam Compare type of predicate to compare objects
+     * @param first iterator to the beggining of the range to be sorted
+     * @param last iterator to the position after the end of the range to be sorted
+     * @param cmp predicate that returns true if the first argument is less than the second
+     * @param pool pool whose threads run the tasks
+     */
+    template< typename RandomIt, typename Compare >
+    void parallel_merge(RandomIt first, RandomIt last, Compare cmp, ThreadPool& pool){
+        auto size {std::distance(first, last)};
+        using ValueType = typename std::iterator_traits<RandomIt>::value_type;
+        // The elements move to the buffer and are sorted back into the range.
+        vector<ValueType> scratch(std::make_move_iterator(first), std::make_move_iterator(last));
+        if (size <= PARALLEL_SORT_CUTOFF or pool.size() == 1)
+            merge_sort_to(scratch.begin(), first, size, false, cmp);
+        else
+            parallel_merge_sort(scratch.begin(), first, size, false, cmp, pool);
+    }
+
+    /// Parallel merge sort running on the `default_pool()`.
+    template< typename RandomIt, typename Compare >
+    void parallel_merge(RandomIt first, RandomIt last, Compare cmp){
+        parallel_merge(first, last, cmp, default_pool());
+    }
+    //}}} PARALLEL MERGE SORT
+
+    //{{{ K-WAY MERGE
+    /**
+     * @brief Tournament tree of losers over the heads of `k` sorted sources.
+     *
+     * Every internal node keeps the loser of the match played there, along with its
+     * key, and the overall winner sits on top. Once the winner is taken, the next element
+     * of its source replays only the log2(k) matches on the path to the root, each one a
+     * single comparison against a key already at hand. Exhausted sources lose every match
+     * and equal keys go to the lower source, so merges through the tree are stable.
+     */
+    template< typename T, typename Compare >
+    class LoserTree {
+        /// Set in `Node::source` once that source is exhausted.
+        static constexpr size_t EXHAUSTED {size_t{1} << (std::numeric_limits<size_t>::digits - 1)};
+        /// Plain keys are compared and selected without branches; others are moved and swapped.
+        static constexpr bool BRANCHLESS {std::is_trivially_copy_constructible_v<T> and std::is_trivially_copy_assignable_v<T>};
+
+        struct Node {
+            T key;
+            size_t source;
+        };
+
+        Compare cmp;
+        vector<Node> nodes;  //!< nodes[0] is the winner; leaf i is node k + i.
+        vector<Node> leaves; //!< Heads given before `build`.
+
+        /**
+         * Whether node `a` goes before node `b`. For plain keys both comparisons are made
+         * so the result can be computed without branches: the matches of a merge are
+         * unpredictable, and mispredictions would dominate the cost otherwise. Other keys
+         * are not compared once moved from, when their source is exhausted.
+         */
+        bool before(const Node& a, const Node& b) const {
+            bool a_exhausted {(a.source & EXHAUSTED) != 0};
+            bool b_exhausted {(b.source & EXHAUSTED) != 0};
+            if constexpr (BRANCHLESS) {
+                bool less {cmp(a.key, b.key)};
+                bool greater {cmp(b.key, a.key)};
+                return (not a_exhausted) & (b_exhausted | less | ((a.source < b.source) & (not greater)));
+            } else {
+                if (a_exhausted or b_exhausted)
+                    return not a_exhausted;
+                return a.source < b.source ? not cmp(b.key, a.key) : cmp(a.key, b.key);
+            }
+        }
+
+        /// Plays every match below `node`, storing the losers in `played`, and returns the winner.
+        Node play(size_t node, vector<std::optional<Node>>& played) {
+            auto k {leaves.size()};
+            if (node >= k)
+                return std::move(leaves[node - k]);
+            auto left {play(2 * node, played)};
+            auto right {play(2 * node + 1, played)};
+            if (before(right, left)) {
+                played[node] = std::move(left);
+                return right;
+            }
+            played[node] = std::move(right);
+            return left;
+        }
+
+        /// Replays the matches on the path of the winner, after its head changed.
+        void replay() {
+            auto node {((nodes[0].source & ~EXHAUSTED) + nodes.size()) / 2};
+            if constexpr (BRANCHLESS) {
+                auto winner {nodes[0]};
+                for (; node > 0; node /= 2) {
+                    auto loser {nodes[node]};
+                    auto loser_wins {before(loser, winner)};
+                    nodes[node] = loser_wins ? winner : loser;
+                    winner = loser_wins ? loser : winner;
+                }
+                nodes[0] = winner;
+            } else {
+                for (; node > 0; node /= 2)
+                    if (before(nodes[node], nodes[0]))
+                        std::swap(nodes[node], nodes[0]);
+            }
+        }
+
+    public:
+        explicit LoserTree(Compare cmp) : cmp{cmp} {}
+
+        /// Adds the next source, given its first element. Empty sources are not added.
+        void add_source(T head) {
+            leaves.push_back(Node{std::move(head), leaves.size()});
+        }
+
+        /// Plays the initial tournament, once every source was added.
+        void build() {
+            auto k {leaves.size()};
+            nodes.clear();
+            if (k == 0)
+                return;
+            vector<std::optional<Node>> played(k);
+            played[0] = play(1, played);
+            nodes.reserve(k);
+            for (auto& node : played)
+                nodes.push_back(std::move(*node));
+            leaves.clear();
+        }
+
+        /// True once every source is exhausted.
+        bool empty() const { return nodes.empty() or (nodes[0].source & EXHAUSTED) != 0; }
+
+        /// Source of the smallest head, counting in the order the sources were added.
+        size_t winner() const { return nodes[0].source & ~EXHAUSTED; }
+
+        /// Smallest head; it may be moved from before `replace_top` or `pop_top`.
+        T& top() { return nodes[0].key; }
+
+        /// Replaces the winner with the next element of its source and replays its path.
+        void replace_top(T next) {
+            nodes[0].key = std::move(next);
+            replay();
+        }
+
+        /// Marks the source of the winner as exhausted and replays its path.
+        void pop_top() {
+            nodes[0].source |= EXHAUSTED;
+            replay();
+        }
+    };
+
+    /**
+     * @brief Merges k sorted ranges into `out`, with a loser tree: every element written
+     * costs about log2(k) comparisons. Equal elements come out in the order of their
+     * ranges, so the merge is stable.
+     *
+     * @tparam RangeIt iterator over `pair`s of iterators [first, last) to the sorted ranges
+     * @tparam OutIt output iterator type
+     * @tparam Compare type of predicate to compare objects
+     * @param first iterator to the beggining of the ranges to be merged
+     * @param last iterator to the position after the end of the ranges to be merged
+     * @param out iterator to the beggining of the destination
+     * @param cmp predicate that returns true if the first argument is less than the second
+     * @return Iterator to the position after the last element written.
+     */
+    template< typename RangeIt, typename OutIt, typename Compare >
+    OutIt kway_merge(RangeIt first, RangeIt last, OutIt out, Compare cmp) {
+        using Range = typename std::iterator_traits<RangeIt>::value_type;
+        using ValueType = typename std::iterator_traits<typename Range::first_type>::value_type;
+        vector<Range> ranges(first, last);
+        if (ranges.size() == 1)
+            return std::copy(ranges[0].first, ranges[0].second, out);
+
+        // Empty ranges stay out of the tree; `sources` maps its sources back to the ranges.
+        LoserTree<ValueType, Compare> tree{cmp};
+        vector<size_t> sources;
+        for (size_t r {0}; r < ranges.size(); r++) {
+            if (ranges[r].first != ranges[r].second) {
+                tree.add_source(*ranges[r].first++);
+                sources.push_back(r);
+            }
+        }
+        tree.build();
+        while (not tree.empty()) {
+            auto& source {ranges[sources[tree.winner()]]};
+            *out++ = std::move(tree.top());
+            if (source.first != source.second)
+                tree.replace_top(*source.first++);
+            else
+                tree.pop_top();
+        }
+        return out;
+    }
+
+    /// Same as `kway_merge`, taking the ranges from a container.
+    template< typename Ranges, typename OutIt, typename Compare >
+    OutIt kway_merge(const Ranges& ranges, OutIt out, Compare cmp) {
+        return kway_merge(std::begin(ranges), std::end(ranges), out, cmp);
+    }
+    //}}} K-WAY MERGE
+
+    //{{{ HEAP SORT
+    /// Moves the element at `root` down the max-heap of `size` elements rooted at `first`.
+    template< typename RandomIt, typename Compare >
+    void sift_down(RandomIt first, std::ptrdiff_t root, std::ptrdiff_t size, Compare cmp) {
+        auto value {std::move(first[root])};
+        auto child {2 * root + 1};
+        while (child < size) {
+            if (child + 1 < size and cmp(first[child], first[child + 1]))
+                child++;
+            if (not cmp(value, first[child]))
+                break;
+            first[root] = std::move(first[child]);
+            root = child;
+            child = 2 * root + 1;
+        }
+        first[root] = std::move(value);
+    }
+
+    /**
+     * @brief Applies heap sort on the range [first, last)
+     *
+     * Builds a max-heap in place and repeatedly moves its top to the end. O(n log n) in
+     * the worst case with no extra memory; used by `quick` as its fallback.
+     *
+     * @tparam RandomIt iterator type
+     * @tparam Compare type of predicate to compare objects
+     * @param first iterator to the beggining of the range to be sorted
+     * @param last iterator to the position after the end of the range to be sorted
+     * @param cmp predicate that returns true if the first argument is less than the second
+     */
+    template< typename RandomIt, typename Compare >
+    void heap(RandomIt first, RandomIt last, Compare cmp){
+        auto size {std::distance(first, last)};
+        for (auto root {size / 2 - 1}; root >= 0; root--)
+            sift_down(first, root, size, cmp);
+        for (auto end {size - 1}; end > 0; end--) {
+            std::iter_swap(first, first + end);
+            sift_down(first, 0, end, cmp);
+        }
+    }
+    //}}} HEAP SORT
+
+    //{{{ QUICK SORT
+    /*!
+     * Partition reorders the elements in the range [first;last) in such a way that
+     * all elements **less** than the pivot appear before the pivot, and all elements
+     * equal or greater than the pivot appear after the pivot.
+     *
+     * Any relative order among elements of the array might not be preserved.
+     *
+     * By **less** we mean a _strict order_ binary relation among the elements we
+     * wantt to partition.
+     *
+     * \note We assume the pivot is a valid iterator in [first; last).
+     *
+     * @param first The first element in the range we want to reorder.
+     * @param last Past the last element in the range we want to reorder.
+     * @param pivot Location of the pivot element we need to partition the array.
+     * @param cmp A comparison function that returns true if the first parameter is **less** than the second.
+     * @return An iterator to the new pivot location within the range.
+     */
+    template<class FwrdIt, class Compare>
+    FwrdIt partition(FwrdIt first, FwrdIt last, FwrdIt pivot, Compare cmp) {
+        std::iter_swap(pivot, last - 1);
+        pivot = last - 1;
+        // Slow/fast approach: operating within the own range.
+        auto slow {first};
+        auto fast {first};
+
+        // Traverse range, rearranging the elements
+        while (fast != last) {
+            // Move smallest to the front region of the array.
+            if (cmp(*fast, *pivot)) {
+                std::iter_swap(fast, slow);
+                slow++;
+            }
+            // Advance frontier..
+            fast++;
+        }
+
+        // We need a final swap, so that the pivot end up in its final position
+        // in the sorted array.
+        std::iter_swap(slow, pivot);
+
+        return slow;
+    }
+    /// Size, in elements, of the blocks scanned by `block_partition`.
+    constexpr std::ptrdiff_t PARTITION_BLOCK_SIZE {64};
+    /// Partitions with at most this many elements are left to `small_sort`.
+    constexpr std::ptrdiff_t QUICK_INSERTION_CUTOFF {24};
+
+    /**
+     * @brief Swaps the `num` misplaced elements recorded in the offset buffers of
+     * `block_partition`: `left + offsets_l[i]` with `right - offsets_r[i]`.
+     *
+     * When both sides have the same number of pending elements a plain swap is used;
+     * otherwise a cyclic permutation saves one move per pair.
+     */
+    template< typename RandomIt >
+    void swap_offsets(RandomIt left, RandomIt right, const unsigned char* offsets_l,
+                      const unsigned char* offsets_r, std::ptrdiff_t num, bool use_swaps) {
+        if (use_swaps) {
+            for (std::ptrdiff_t i {0}; i < num; i++)
+                std::iter_swap(left + offsets_l[i], right - offsets_r[i]);
+        } else if (num > 0) {
+            auto l {left + offsets_l[0]};
+            auto r {right - offsets_r[0]};
+            auto tmp {std::move(*l)};
+            *l = std::move(*r);
+            for (std::ptrdiff_t i {1}; i < num; i++) {
+                l = left + offsets_l[i];
+                *r = std::move(*l);
+                r = right - offsets_r[i];
+                *l = std::move(*r);
+            }
+            *r = std::move(tmp);
+        }
+    }
+
+    /*!
+     * Branchless block partition (BlockQuicksort, Edelkamp and Weiß): same contract as
+     * `partition`, with the pivot taken from `*first`.
+     *
+     * Instead of branching on every comparison, each side scans a block of up to
+     * `PARTITION_BLOCK_SIZE` elements and records the offsets of the misplaced ones
+     * with branch-free arithmetic; the recorded elements are then swapped pairwise.
+     * This removes the branch mispredictions that dominate partitioning random data.
+     *
+     * \note We assume `*(last - 1)` is not less than the pivot (median-of-three
+     * guarantees it), which serves as a sentinel for the first scan.
+     *
+     * @param first The first element in the range we want to reorder; holds the pivot.
+     * @param last Past the last element in the range we want to reorder.
+     * @param cmp A comparison function that returns true if the first parameter is **less** than the second.
+     * @return An iterator to the new pivot location within the range.
+     */
+    template< typename RandomIt, typename Compare >
+    RandomIt block_partition(RandomIt first, RandomIt last, Compare cmp) {
+        auto pivot {std::move(*first)};
+        auto left {first};
+        auto right {last};
+
+        // Skip the prefix already in place, and the suffix already in place.
+        while (cmp(*++left, pivot));
+        if (left - 1 == first)
+            while (left < right and not cmp(*--right, pivot));
+        else
+            while (not cmp(*--right, pivot));
+
+        if (left < right) {
+            std::iter_swap(left, right);
+            ++left;
+
+            unsigned char offsets_l[PARTITION_BLOCK_SIZE];
+            unsigned char offsets_r[PARTITION_BLOCK_SIZE];
+            auto base_l {left};
+            auto base_r {right};
+            std::ptrdiff_t num_l {0}, num_r {0}, start_l {0}, start_r {0};
+
+            while (left < right) {
+                // Split what is left between the sides whose offset buffers are empty.
+                auto num_unknown {right - left};
+                auto left_split {num_l == 0 ? (num_r == 0 ? num_unknown / 2 : num_unknown) : 0};
+                auto right_split {num_r == 0 ? num_unknown - left_split : 0};
+
+                for (std::ptrdiff_t i {0}; i < std::min(left_split, PARTITION_BLOCK_SIZE); ++left) {
+                    offsets_l[num_l] = static_cast<unsigned char>(i++);
+                    num_l += not cmp(*left, pivot);
+                }
+                for (std::ptrdiff_t i {0}; i < std::min(right_split, PARTITION_BLOCK_SIZE);) {
+                    offsets_r[num_r] = static_cast<unsigned char>(++i);
+                    num_r += cmp(*--right, pivot);
+                }
+
+                auto num {std::min(num_l, num_r)};
+                swap_offsets(base_l, base_r, offsets_l + start_l, offsets_r + start_r, num, num_l == num_r);
+                num_l -= num;
+                num_r -= num;
+                start_l += num;
+                start_r += num;
+                if (num_l == 0) {
+                    start_l = 0;
+                    base_l = left;
+                }
+                if (num_r == 0) {
+                    start_r = 0;
+                    base_r = right;
+                }
+            }
+
+            // One side may still have misplaced elements: move them next to the boundary.
+            if (num_l > 0) {
+                while (num_l--)
+                    std::iter_swap(base_l + offsets_l[start_l + num_l], --right);
+                left = right;
+            }
+            if (num_r > 0) {
+                while (num_r--)
+                    std::iter_swap(base_r - offsets_r[start_r + num_r], left++);
+                right = left;
+            }
+        }
+
+        // Put the pivot in its final position.
+        auto pivot_pos {left - 1};
+        *first = std::move(*pivot_pos);
+        *pivot_pos = std::move(pivot);
+        return pivot_pos;
+    }
+
+    /**
+     * Median-of-three, with the median moved to the front as the pivot of `block_partition`.
+     * The smallest stays in the middle and the largest at the end as a sentinel.
+     */
+    template< typename RandomIt, typename Compare >
+    void median_of_three_to_front(RandomIt first, RandomIt last, Compare cmp) {
+        auto mid {first + (last - first) / 2};
+        if (cmp(*(last - 1), *first))
+            std::iter_swap(last - 1, first);
+        if (cmp(*mid, *first))
+            std::iter_swap(mid, first);
+        if (cmp(*(last - 1), *mid))
+            std::iter_swap(mid, last - 1);
+        std::iter_swap(first, mid);
+    }
+
+    /*!
+     * Partition of [first, last) around the pivot `*first` that puts the elements equal
+     * to it on its left (pdqsort, Peters): the elements not greater than the pivot
+     * first, then the pivot, then the greater ones.
+     *
+     * Used when the pivot is known to be the smallest element of the range, so the left
+     * side holds exactly the keys equal to it, which are then done with.
+     *
+     * @return An iterator to the new pivot location: the last of the elements equal to it.
+     */
+    template< typename RandomIt, typename Compare >
+    RandomIt partition_left(RandomIt first, RandomIt last, Compare cmp) {
+        auto pivot {std::move(*first)};
+        auto left {first};
+        auto right {last};
+
+        while (cmp(pivot, *--right));
+        // Without an element greater than the pivot after `left`, the scan must be bounded.
+        if (right + 1 == last)
+            while (left < right and not cmp(pivot, *++left));
+        else
+            while (not cmp(pivot, *++left));
+
+        while (left < right) {
+            std::iter_swap(left, right);
+            while (cmp(pivot, *--right));
+            while (not cmp(pivot, *++left));
+        }
+
+        *first = std::move(*right);
+        *right = std::move(pivot);
+        return right;
+    }
+
+    /**
+     * @brief Introsort loop: recurses on the smaller side, loops on the larger one.
+     *
+     * Unless the range is `leftmost`, the element just before it is a former pivot, not
+     * greater than any element of the range. A pivot equal to it is then the smallest
+     * key of the range: `partition_left` puts all the keys equal to it aside in one
+     * pass, so runs of equal keys never split one element at a time.
+     */
+    template< typename RandomIt, typename Compare >
+    void intro_loop(RandomIt first, RandomIt last, int depth_limit, Compare cmp, bool leftmost) {
+        while (last - first > QUICK_INSERTION_CUTOFF) {
+            // Too many bad splits: heap sort keeps the worst case in O(n log n).
+            if (depth_limit == 0) {
+                heap(first, last, cmp);
+                return;
+            }
+            depth_limit--;
+
+            median_of_three_to_front(first, last, cmp);
+            if (not leftmost and not cmp(*(first - 1), *first)) {
+                first = partition_left(first, last, cmp) + 1;
+                continue;
+            }
+            auto pivot {block_partition(first, last, cmp)};
+            if (pivot - first < last - pivot) {
+                intro_loop(first, pivot, depth_limit, cmp, leftmost);
+                first = pivot + 1;
+                leftmost = false;
+            } else {
+                intro_loop(pivot + 1, last, depth_limit, cmp, false);
+                last = pivot;
+            }
+        }
+        small_sort(first, last, cmp);
+    }
+
+    /**
+     * @brief Quick sort implementation (introsort).
+     *
+     * Median-of-three pivots and a branchless `block_partition`; partitions of at most
+     * `QUICK_INSERTION_CUTOFF` elements are finished by `small_sort`, and once the
+     * recursion goes deeper than 2 log2(n) levels the partition is heap sorted, so the
+     * worst case is O(n log n) and the stack depth is O(log n). Keys equal to the
+     * previous pivot are set aside by `partition_left` in one pass, so many duplicates
+     * make the sort faster rather than slower.
+     *
+     * @tparam RandomIt iterator type
+     * @tparam Compare type of predicate to compare objects
+     * @param first iterator to the beggining of the range to be sorted
+     * @param last iterator to the position after the end of the range to be sorted
+     * @param cmp predicate that returns true if the first argument is less than the second
+     */
+    template<typename RandomIt, typename Compare>
+    void quick(RandomIt first, RandomIt last, Compare cmp) {
+        auto size {std::distance(first, last)};
+        if (size <= 1)
+            return;
+
+        int depth_limit {0};
+        for (auto n {size}; n > 1; n /= 2)
+            depth_limit += 2;
+        intro_loop(first, last, depth_limit, cmp, true);
+    }
+    //}}} QUICK SORT
+
+    //{{{ SELECTION
+    /**
+     * @brief Narrows the range [first, last) searched for `nth` after a partition left
+     * `pivot` in its final position. Returns true when `nth` is in its final position.
+     *
+     * The elements equal to the pivot all end up after it, so when few elements went
+     * before it they are gathered right after it: no pivot could ever split a run of
+     * equal keys, and without this an input of few distinct keys would take quadratic time.
+     */
+    template< typename RandomIt, typename Compare >
+    bool narrow_selection(RandomIt& first, RandomIt& last, RandomIt nth, RandomIt pivot, Compare cmp) {
+        if (nth < pivot) {
+            last = pivot;
+            return false;
+        }
+        if (nth == pivot)
+            return true;
+        if (pivot - first < (last - first) / 8) {
+            auto equal_last {std::partition(pivot + 1, last, [&](const auto& x) { return not cmp(*pivot, x); })};
+            if (nth < equal_last)
+                return true;
+            first = equal_last;
+            return false;
+        }
+        first = pivot + 1;
+        return false;
+    }
+
+    template< typename RandomIt, typename Compare >
+    void select_linear(RandomIt first, RandomIt nth, RandomIt last, Compare cmp);
+
+    /**
+     * @brief Median of medians (Blum, Floyd, Pratt, Rivest and Tarjan): the median of the
+     * medians of groups of five, which has at least 30% of the range on each side.
+     *
+     * The medians are gathered at the front of the range, and the returned pivot is among them.
+     */
+    template< typename RandomIt, typename Compare >
+    RandomIt median_of_medians(RandomIt first, RandomIt last, Compare cmp) {
+        auto medians {first};
+        for (auto group {first}; group < last; group += std::min<std::ptrdiff_t>(5, last - group)) {
+            auto group_last {group + std::min<std::ptrdiff_t>(5, last - group)};
+            insertion(group, group_last, cmp);
+            std::iter_swap(medians++, group + (group_last - group) / 2);
+        }
+        auto pivot {first + (medians - first) / 2};
+        select_linear(first, pivot, medians, cmp);
+        return pivot;
+    }
+
+    /// Selection in O(n) in the worst case, `partition` around the median of medians: the fallback of `nth_element`.
+    template< typename RandomIt, typename Compare >
+    void select_linear(RandomIt first, RandomIt nth, RandomIt last, Compare cmp) {
+        while (last - first > QUICK_INSERTION_CUTOFF) {
+            auto pivot {sa::partition(first, last, median_of_medians(first, last, cmp), cmp)};
+            if (narrow_selection(first, last, nth, pivot, cmp))
+                return;
+        }
+        small_sort(first, last, cmp);
+    }
+
+    /**
+     * @brief Rearranges the range [first, last) so that `*nth` is the element that would be
+     * there if the range were sorted, no element before it is greater and no element after
+     * it is less (introselect, Musser).
+     *
+     * Quickselect with the median-of-three pivot and branchless `block_partition` of
+     * `quick`, in O(n) on average. The range must halve every two partitions; when it does
+     * not, the pivots are bad and `select_linear` takes over, so the work done before the
+     * switch is at most 4n and the worst case stays O(n).
+     *
+     * @tparam RandomIt iterator type
+     * @tparam Compare type of predicate to compare objects
+     * @param first iterator to the beggining of the range
+     * @param nth iterator to the position to fill with its sorted element
+     * @param last iterator to the position after the end of the range
+     * @param cmp predicate that returns true if the first argument is less than the second
+     */
+    template< typename RandomIt, typename Compare >
+    void nth_element(RandomIt first, RandomIt nth, RandomIt last, Compare cmp){
+        if (nth == last)
+            return;
+        auto size_limit {last - first};
+        int partitions {0};
+        while (last - first > QUICK_INSERTION_CUTOFF) {
+            if (partitions == 2) {
+                if (last - first > size_limit / 2) {
+                    select_linear(first, nth, last, cmp);
+                    return;
+                }
+                size_limit = last - first;
+                partitions = 0;
+            }
+            partitions++;
+            median_of_three_to_front(first, last, cmp);
+            auto pivot {block_partition(first, last, cmp)};
+            if (narrow_selection(first, last, nth, pivot, cmp))
+                return;
+        }
+        small_sort(first, last, cmp);
+    }
+
+    /// `partial_sort` keeps a heap of the k smallest when k is at most this fraction of n.
+    constexpr std::ptrdiff_t PARTIAL_SORT_HEAP_RATIO {1024};
+
+    /**
+     * @brief Rearranges the range [first, last) so that [first, middle) holds its smallest
+     * elements, sorted; the order of the others is unspecified.
+     *
+     * Selects the boundary with `nth_element` and sorts the front with `quick`: O(n + k log k)
+     * for k = `middle - first`. A small k is served by a heap select instead, which reads
+     * the input once and usually costs one comparison per element.
+     *
+     * @tparam RandomIt iterator type
+     * @tparam Compare type of predicate to compare objects
+     * @param first iterator to the beggining of the range
+     * @param middle iterator to the end of the part to sort
+     * @param last iterator to the position after the end of the range
+     * @param cmp predicate that returns true if the first argument is less than the second
+     */
+    template< typename RandomIt, typename Compare >
+    void partial_sort(RandomIt first, RandomIt middle, RandomIt last, Compare cmp){
+        auto k {middle - first};
+        if (k == 0)
+            return;
+        if (k * PARTIAL_SORT_HEAP_RATIO <= last - first) {
+            // Heap select: most elements are rejected by one comparison with the largest kept.
+            for (auto root {k / 2 - 1}; root >= 0; root--)
+                sift_down(first, root, k, cmp);
+            for (auto it {middle}; it != last; ++it)
+                if (cmp(*it, *first)) {
+                    std::iter_swap(it, first);
+                    sift_down(first, 0, k, cmp);
+                }
+            for (auto end {k - 1}; end > 0; end--) {
+                std::iter_swap(first, first + end);
+                sift_down(first, 0, end, cmp);
+            }
+            return;
+        }
+        sa::nth_element(first, middle - 1, last, cmp);
+        quick(first, middle - 1, cmp);
+    }
+
+    /**
+     * @brief The `k` smallest of a stream of elements of unknown length, in O(1) amortized
+     * time per element.
+     *
+     * Elements go to a buffer of 2k; each time it fills, `nth_element` keeps its k smallest
+     * and the largest of them becomes a threshold, below which an element must be to enter
+     * the buffer at all. Once the threshold has settled, most elements are rejected by a
+     * single comparison.
+     * @tparam T element type
+     * @tparam Compare type of predicate to compare objects
+     */
+    template< typename T, typename Compare >
+    class TopK {
+        std::vector<T> buffer;
+        size_t k;
+        Compare cmp;
+        bool has_threshold {false}; //!< Whether `buffer[k - 1]` is the largest of the k smallest seen so far.
+
+        void shrink() {
+            sa::nth_element(buffer.begin(), buffer.begin() + (k - 1), buffer.end(), cmp);
+            buffer.resize(k);
+            has_threshold = true;
+        }
+
+    public:
+        TopK(size_t k, Compare cmp) : k{k}, cmp{cmp} {
+            buffer.reserve(2 * k);
+        }
+
+        /// Offers `value` to the selection.
+        template< typename U >
+        void push(U&& value) {
+            if (k == 0 or (has_threshold and not cmp(value, buffer[k - 1])))
+                return;
+            buffer.push_back(std::forward<U>(value));
+            if (buffer.size() == 2 * k)
+                shrink();
+        }
+
+        /// Returns the (at most) k smallest elements offered, sorted, and empties the selection.
+        std::vector<T> take() {
+            if (buffer.size() > k)
+                shrink();
+            quick(buffer.begin(), buffer.end(), cmp);
+            has_threshold = false;
+            return std::move(buffer);
+        }
+    };
+
+    /**
+     * @brief Returns the `k` smallest elements of [first, last), sorted, reading the range once.
+     * @tparam InputIt input iterator type: the range may be a stream read once
+     * @tparam Compare type of predicate to compare objects
+     */
+    template< typename InputIt, typename Compare >
+    std::vector<typename std::iterator_traits<InputIt>::value_type> top_k(InputIt first, InputIt last, size_t k, Compare cmp){
+        TopK<typename std::iterator_traits<InputIt>::value_type, Compare> selection{k, cmp};
+        for (; first != last; ++first)
+            selection.push(*first);
+        return selection.take();
+    }
+    //}}} SELECTION
+
+    //{{{ THREE-WAY QUICK SORT
+    /*!
+     * Three-way (fat) partition, following Bentley and McIlroy: reorders the elements in
+     * the range [first;last) into three groups, those **less** than the pivot, those
+     * **equal** to it and those **greater** than it.
+     *
+     * During the scan, keys equal to the pivot are parked at both ends of the range and
+     * only moved to the middle at the end, so the common case (few equal keys) costs
+     * almost no extra swaps, while ranges with many duplicates shrink quickly.
+     *
+     * \note We assume the pivot is a valid iterator in [first; last), and two elements
+     * `a` and `b` are **equal** when neither `cmp(a, b)` nor `cmp(b, a)` holds.
+     *
+     * @param first The first element in the range we want to reorder.
+     * @param last Past the last element in the range we want to reorder.
+     * @param pivot Location of the pivot element we need to partition the array.
+     * @param cmp A comparison function that returns true if the first parameter is **less** than the second.
+     * @return The range [lower, upper) of the elements equal to the pivot.
+     */
+    template< typename RandomIt, typename Compare >
+    std::pair<RandomIt, RandomIt> partition3(RandomIt first, RandomIt last, RandomIt pivot, Compare cmp) {
+        if (last - first < 2)
+            return {first, last};
+        std::iter_swap(first, pivot);
+        // The pivot stays at `first` (index 0) during the scan.
+        const auto& value {*first};
+        auto equal = [&](const auto& x) { return not cmp(x, value) and not cmp(value, x); };
+
+        std::ptrdiff_t hi {std::distance(first, last) - 1};
+        std::ptrdiff_t i {0}, j {hi + 1};   // scan indices
+        std::ptrdiff_t p {0}, q {hi + 1};   // [0, p] and [q, hi] hold keys equal to the pivot
+        while (true) {
+            while (cmp(first[++i], value))
+                if (i == hi)
+                    break;
+            while (cmp(value, first[--j]))
+                if (j == 0)
+                    break;
+            if (i == j and equal(first[i]))
+                std::iter_swap(first + ++p, first + i);
+            if (i >= j)
+                break;
+            std::iter_swap(first + i, first + j);
+            if (equal(first[i]))
+                std::iter_swap(first + ++p, first + i);
+            if (equal(first[j]))
+                std::iter_swap(first + --q, first + j);
+        }
+
+        // Bring the parked equal keys from both ends to the middle.
+        i = j + 1;
+        for (std::ptrdiff_t k {0}; k <= p; k++)
+            std::iter_swap(first + k, first + j--);
+        for (std::ptrdiff_t k {hi}; k >= q; k--)
+            std::iter_swap(first + k, first + i++);
+        return {first + j + 1, first + i};
+    }
+
+    /// Three-way quick sort loop: recurses on the smaller side, loops on the larger one.
+    template< typename RandomIt, typename Compare >
+    void quick3_loop(RandomIt first, RandomIt last, int depth_limit, Compare cmp) {
+        while (last - first > QUICK_INSERTION_CUTOFF) {
+            if (depth_limit == 0) {
+                heap(first, last, cmp);
+                return;
+            }
+            depth_limit--;
+
+            auto mid {first + (last - first) / 2};
+            if (cmp(*(last - 1), *first))
+                std::iter_swap(last - 1, first);
+            if (cmp(*mid, *first))
+                std::iter_swap(mid, first);
+            if (cmp(*(last - 1), *mid))
+                std::iter_swap(mid, last - 1);
+
+            // Keys equal to the pivot are already in place and never looked at again.
+            auto equal_range {partition3(first, last, mid, cmp)};
+            if (equal_range.first - first < last - equal_range.second) {
+                quick3_loop(first, equal_range.first, depth_limit, cmp);
+                first = equal_range.second;
+            } else {
+                quick3_loop(equal_range.second, last, depth_limit, cmp);
+                last = equal_range.first;
+            }
+        }
+        small_sort(first, last, cmp);
+    }
+
+    /**
+     * @brief Three-way quick sort on the range [first, last), built on `partition3`.
+     *
+     * Same scheme as `quick` (median-of-three, insertion cutoff, heap sort depth limit),
+     * but equal keys are grouped around the pivot and excluded from both recursive calls,
+     * so inputs with few distinct keys take close to O(n) time instead of degrading.
+     *
+     * @tparam RandomIt iterator type
+     * @tparam Compare type of predicate to compare objects
+     * @param first iterator to the beggining of the range to be sorted
+     * @param last iterator to the position after the end of the range to be sorted
+     * @param cmp predicate that returns true if the first argument is less than the second
+     */
+    template< typename RandomIt, typename Compare >
+    void quick3(RandomIt first, RandomIt last, Compare cmp) {
+        auto size {std::distance(first, last)};
+        if (size <= 1)
+            return;
+
+        int depth_limit {0};
+        for (auto n {size}; n > 1; n /= 2)
+            depth_limit += 2;
+        quick3_loop(first, last, depth_limit, cmp);
+    }
+    //}}} THREE-WAY QUICK SORT
+
+    //{{{ PARALLEL SAMPLE SORT
+    /// Below this many elements the parallel sample sort falls back to the sequential `quick`.
+    constexpr std::ptrdiff_t PARALLEL_SAMPLE_CUTOFF {1 << 14};
+    /// Number of buckets per thread: extra buckets even out the per-bucket sorting work.
+    constexpr size_t SAMPLE_BUCKETS_PER_THREAD {4};
+    /// Maximum number of buckets of a single sample sort step.
+    constexpr size_t SAMPLE_MAX_BUCKETS {1024};
+    /// Samples drawn per bucket to choose the splitters.
+    constexpr size_t SAMPLE_OVERSAMPLING {16};
+
+    /**
+     * @brief Sorts the `n` elements at `data` using `buffer` (same size) as scratch.
+     *
+     * Splitters are chosen from a sorted random sample. Each thread classifies its own
+     * slice (binary search over the splitters), counts its buckets and then scatters the
+     * slice into `buffer` at offsets derived from all the counts. Finally every bucket is
+     * sorted by its own task and moved back. When the sample has repeated keys, each
+     * splitter also gets an *equality bucket* that needs no sorting at all.
+     */
+    template< typename RandomIt, typename BufferIt, typename Compare >
+    void parallel_sample_sort(RandomIt data, BufferIt buffer, std::ptrdiff_t n, Compare cmp, ThreadPool& pool) {
+        using ValueType = typename std::iterator_traits<RandomIt>::value_type;
+        auto n_threads {pool.size()};
+
+        // Draw the sample into the front of `data` (a partial shuffle) and sort it in place,
+        // so the splitters are just positions: no element is copied. They are only read while
+        // classifying, before anything moves. Repeated splitters are kept only once.
+        auto n_buckets {std::min(SAMPLE_MAX_BUCKETS, SAMPLE_BUCKETS_PER_THREAD * n_threads)};
+        auto sample_size {static_cast<std::ptrdiff_t>(n_buckets * SAMPLE_OVERSAMPLING)};
+        std::minstd_rand generator(static_cast<std::minstd_rand::result_type>(n));
+        for (std::ptrdiff_t i {0}; i < sample_size; i++)
+            std::iter_swap(data + i, data + std::uniform_int_distribution<std::ptrdiff_t>(i, n - 1)(generator));
+        quick(data, data + sample_size, cmp);
+        vector<RandomIt> splitters;
+        bool equality_buckets {false};
+        for (size_t b {1}; b < n_buckets; b++) {
+            auto candidate {data + b * SAMPLE_OVERSAMPLING};
+            if (not splitters.empty() and not cmp(*splitters.back(), *candidate))
+                equality_buckets = true;
+            else
+                splitters.push_back(candidate);
+        }
+        // Bucket 2i holds keys between splitters i-1 and i, bucket 2i+1 keys equal to splitter i.
+        auto n_classes {2 * splitters.size() + 1};
+        auto classify = [&splitters, equality_buckets, cmp](const ValueType& value) {
+            auto i {std::upper_bound(splitters.begin(), splitters.end(), value,
+                                     [cmp](const ValueType& v, RandomIt splitter) { return cmp(v, *splitter); }) - splitters.begin()};
+            if (equality_buckets and i > 0 and not cmp(*splitters[i - 1], value))
+                return static_cast<std::uint16_t>(2 * i - 1);
+            return static_cast<std::uint16_t>(2 * i);
+        };
+
+        auto n_slices {static_cast<std::ptrdiff_t>(n_threads)};
+        auto slice_begin = [n, n_slices](std::ptrdiff_t t) { return n * t / n_slices; };
+        vector<std::uint16_t> bucket_of(n);
+        vector<size_t> offsets(n_slices * n_classes, 0);
+        {
+            TaskGroup group{pool};
+            for (std::ptrdiff_t t {0}; t < n_slices; t++) {
+                group.run([=, &bucket_of, &offsets, &classify] {
+                    auto counts {&offsets[t * n_classes]};
+                    for (auto i {slice_begin(t)}; i < slice_begin(t + 1); i++)
+                        counts[bucket_of[i] = classify(data[i])]++;
+                });
+            }
+            group.wait();
+        }
+
+        vector<size_t> bucket_begin(n_classes + 1, 0);
+        size_t sum {0};
+        for (size_t b {0}; b < n_classes; b++) {
+            bucket_begin[b] = sum;
+            for (std::ptrdiff_t t {0}; t < n_slices; t++) {
+                auto count {offsets[t * n_classes + b]};
+                offsets[t * n_classes + b] = sum;
+                sum += count;
+            }
+        }
+        bucket_begin[n_classes] = n;
+
+        {
+            TaskGroup group{pool};
+            for (std::ptrdiff_t t {0}; t < n_slices; t++) {
+                group.run([=, &bucket_of, &offsets] {
+                    auto slice_offsets {&offsets[t * n_classes]};
+                    for (auto i {slice_begin(t)}; i < slice_begin(t + 1); i++)
+                        buffer[slice_offsets[bucket_of[i]]++] = std::move(data[i]);
+                });
+            }
+            group.wait();
+        }
+
+        // Sort each bucket in `buffer` and move it back; buckets still too large are split again.
+        auto large_bucket {std::max<std::ptrdiff_t>(PARALLEL_SAMPLE_CUTOFF, 2 * n / n_threads)};
+        TaskGroup group{pool};
+        for (size_t b {0}; b < n_classes; b++) {
+            auto begin {static_cast<std::ptrdiff_t>(bucket_begin[b])};
+            auto size {static_cast<std::ptrdiff_t>(bucket_begin[b + 1]) - begin};
+            if (size == 0)
+                continue;
+            bool sorted {b % 2 == 1};  // equality bucket
+            group.run([=, &pool] {
+                if (not sorted and size > large_bucket and size < n)
+                    parallel_sample_sort(buffer + begin, data + begin, size, cmp, pool);
+                else if (not sorted)
+                    quick(buffer + begin, buffer + begin + size, cmp);
+                std::move(buffer + begin, buffer + begin + size, data + begin);
+            });
+        }
+        group.wait();
+    }
+
+    /// Calls `f(t, begin, end)` for each of the `pool.size()` consecutive slices [begin, end) of [0, n), in parallel.
+    template< typename Function >
+    void parallel_slices(std::ptrdiff_t n, ThreadPool& pool, Function f) {
+        auto n_slices {static_cast<std::ptrdiff_t>(pool.size())};
+        TaskGroup group{pool};
+        for (std::ptrdiff_t t {0}; t < n_slices; t++)
+            group.run([=] { f(t, n * t / n_slices, n * (t + 1) / n_slices); });
+        group.wait();
+    }
+
+    /// Uninitialized storage a range is moved into, and back out of, in parallel slices.
+    template< typename T >
+    class ParallelMoveBuffer {
+        std::allocator<T> allocator;
+        std::ptrdiff_t n;
+        T* elements;
+        ThreadPool& pool;
+
+    public:
+        template< typename RandomIt >
+        ParallelMoveBuffer(RandomIt first, std::ptrdiff_t n, ThreadPool& pool)
+            : n{n}, elements{allocator.allocate(n)}, pool{pool} {
+            auto n_slices {static_cast<std::ptrdiff_t>(pool.size())};
+            vector<char> built(n_slices, 0);
+            try {
+                parallel_slices(n, pool, [&](std::ptrdiff_t t, std::ptrdiff_t begin, std::ptrdiff_t end) {
+                    std::uninitialized_move(first + begin, first + end, elements + begin);
+                    built[t] = 1;
+                });
+            } catch (...) {
+                // A slice that threw already destroyed its own elements.
+                for (std::ptrdiff_t t {0}; t < n_slices; t++)
+                    if (built[t])
+                        std::destroy(elements + n * t / n_slices, elements + n * (t + 1) / n_slices);
+                allocator.deallocate(elements, n);
+                throw;
+            }
+        }
+        ParallelMoveBuffer(const ParallelMoveBuffer&) = delete;
+        ParallelMoveBuffer& operator=(const ParallelMoveBuffer&) = delete;
+        ~ParallelMoveBuffer() {
+            parallel_slices(n, pool, [this](std::ptrdiff_t, std::ptrdiff_t begin, std::ptrdiff_t end) {
+                std::destroy(elements + begin, elements + end);
+            });
+            allocator.deallocate(elements, n);
+        }
+
+        T* begin() { return elements; }
+
+        /// Moves the elements back to the range starting at `first`.
+        template< typename RandomIt >
+        void move_to(RandomIt first) {
+            parallel_slices(n, pool, [this, first](std::ptrdiff_t, std::ptrdiff_t begin, std::ptrdiff_t end) {
+                std::move(elements + begin, elements + end, first + begin);
+            });
+        }
+    };
+
+    /**
+     * @brief Applies a parallel sample sort on the range [first, last)
+     *
+     * A comparison sort for multi-core machines that works with any comparator `cmp`:
+     * splitters are chosen from a sorted random sample, the elements are distributed to
+     * buckets in parallel, and the buckets are sorted concurrently with `quick`. Ranges
+     * smaller than `PARALLEL_SAMPLE_CUTOFF` use `quick` directly. The sort is not stable.
+     *
+     * @tparam RandomIt iterator type
+     * @tparam Compare type of predicate to compare objects
+     * @param first iterator to the beggining of the range to be sorted
+     * @param last iterator to the position after the end of the range to be sorted
+     * @param cmp predicate that returns true if the first argument is less than the second
+     * @param pool pool whose threads run the tasks
+     */
+    template< typename RandomIt, typename Compare >
+    void parallel_sample(RandomIt first, RandomIt last, Compare cmp, ThreadPool& pool){
+        auto size {std::distance(first, last)};
+        if (size <= PARALLEL_SAMPLE_CUTOFF or pool.size() == 1) {
+            quick(first, last, cmp);
+            return;
+        }
+        using ValueType = typename std::iterator_traits<RandomIt>::value_type;
+        if constexpr (std::is_default_constructible<ValueType>::value) {
+            // The buckets are sorted back into the range, so only the scratch is allocated.
+            vector<ValueType> scratch(size);
+            parallel_sample_sort(first, scratch.begin(), size, cmp, pool);
+        } else {
+            // No scratch can be made without elements: they move out, are sorted with the
+            // range as scratch and move back.
+            ParallelMoveBuffer<ValueType> elements{first, size, pool};
+            parallel_sample_sort(elements.begin(), first, size, cmp, pool);
+            elements.move_to(first);
+        }
+    }
+
+    /// Parallel sample sort running on the `default_pool()`.
+    template< typename RandomIt, typename Compare >
+    void parallel_sample(RandomIt first, RandomIt last, Compare cmp){
+        parallel_sample(first, last, cmp, default_pool());
+    }
+    //}}} PARALLEL SAMPLE SORT
+
+    //{{{ BATCHED SORT
+    /// Size classes of `batch_sort`: arrays of up to 8, 16, 32, 64 and 256 elements, then the longer ones.
+    constexpr std::ptrdiff_t BATCH_CLASS_SIZES[] {8, 16, 32, NETWORK_MAX_SIZE, 4 * NETWORK_MAX_SIZE};
+    constexpr size_t N_BATCH_CLASSES {std::size(BATCH_CLASS_SIZES) + 1};
+    /// Elements sorted by one task of `batch_sort`, about: enough to outweigh scheduling it.
+    constexpr std::ptrdiff_t BATCH_TASK_ELEMENTS {1 << 14};
+
+    /// Sorts the arrays `ids` of a `batch_sort` size class with the SIMD network of width `Width`.
+    template< int Width, typename RandomIt, typename OffsetIt >
+    void batch_sort_class(RandomIt values, OffsetIt offsets, const std::uint32_t* ids, size_t count) {
+        simd_network_blocks<Width>(values, count, [=](size_t b) {
+            return std::pair<std::ptrdiff_t, std::ptrdiff_t>(offsets[ids[b]], offsets[ids[b] + 1]);
+        });
+    }
+
+    /// `merge_runs` for arithmetic keys under `<`, without a branch on the comparison.
+    template< typename InIt, typename OutIt >
+    OutIt merge_runs_branchless(InIt a, InIt a_last, InIt b, InIt b_last, OutIt out) {
+        while (a != a_last and b != b_last) {
+            bool take_b {*b < *a};
+            *out++ = take_b ? *b : *a;
+            a += not take_b;
+            b += take_b;
+        }
+        out = std::copy(a, a_last, out);
+        return std::copy(b, b_last, out);
+    }
+
+    /**
+     * Sorts the SIMD network keys of the array [first, last), of at most
+     * `4 * NETWORK_MAX_SIZE` of them: network sorted blocks of `NETWORK_MAX_SIZE`, merged
+     * through a buffer on the stack.
+     */
+    template< typename RandomIt >
+    void batch_sort_blocks(RandomIt first, RandomIt last) {
+        using ValueType = typename std::iterator_traits<RandomIt>::value_type;
+        auto n {last - first};
+        auto n_full {n / NETWORK_MAX_SIZE};
+        simd_network_blocks<NETWORK_MAX_SIZE>(first, n_full, [](size_t b) {
+            auto begin {static_cast<std::ptrdiff_t>(b) * NETWORK_MAX_SIZE};
+            return std::pair<std::ptrdiff_t, std::ptrdiff_t>(begin, begin + NETWORK_MAX_SIZE);
+        });
+        simd_network(first + n_full * NETWORK_MAX_SIZE, n - n_full * NETWORK_MAX_SIZE);
+
+        ValueType buffer[4 * NETWORK_MAX_SIZE];
+        bool in_buffer {false};
+        for (auto width {NETWORK_MAX_SIZE}; width < n; width *= 2) {
+            for (std::ptrdiff_t lo {0}; lo < n; lo += 2 * width) {
+                auto mid {std::min(lo + width, n)};
+                auto hi {std::min(lo + 2 * width, n)};
+                if (in_buffer)
+                    merge_runs_branchless(buffer + lo, buffer + mid, buffer + mid, buffer + hi, first + lo);
+                else
+                    merge_runs_branchless(first + lo, first + mid, first + mid, first + hi, buffer + lo);
+            }
+            in_buffer = not in_buffer;
+        }
+        if (in_buffer)
+            std::copy(buffer, buffer + n, first);
+    }
+
+    /**
+     * @brief Sorts each of the `n_arrays` arrays of a CSR (compressed sparse row) layout:
+     * array `i` is [values + offsets[i], values + offsets[i + 1]).
+     *
+     * Sorting many tiny arrays one call at a time is mostly call and dispatch overhead.
+     * Here the arrays are first bucketed by size class (a counting sort of their indices),
+     * so each class runs one kernel over all its arrays: `int32`/`int64`/`float` keys under
+     * `std::less` go through the SIMD network of the class width, dispatched once per
+     * batch, or up to 256 keys through networks of 64 and branchless merges; anything
+     * else goes through `small_sort`, and longer arrays through `quick`. Each class is cut into batches of about
+     * `BATCH_TASK_ELEMENTS` elements, which run on the pool.
+     *
+     * @tparam RandomIt iterator type of the values
+     * @tparam OffsetIt iterator type of the `n_arrays + 1` non-decreasing offsets
+     * @tparam Compare type of predicate to compare objects
+     * @param values iterator to the first value of the layout
+     * @param offsets iterator to the offset of each array in `values`, followed by the end offset
+     * @param n_arrays number of arrays
+     * @param cmp predicate that returns true if the first argument is less than the second
+     * @param pool threads to run on
+     */
+    template< typename RandomIt, typename OffsetIt, typename Compare >
+    void batch_sort(RandomIt values, OffsetIt offsets, size_t n_arrays, Compare cmp, ThreadPool& pool){
+        using ValueType = typename std::iterator_traits<RandomIt>::value_type;
+        auto class_of = [offsets](size_t i) {
+            auto size {static_cast<std::ptrdiff_t>(offsets[i + 1] - offsets[i])};
+            size_t c {0};
+            while (c < std::size(BATCH_CLASS_SIZES) and size > BATCH_CLASS_SIZES[c])
+                c++;
+            return c;
+        };
+        // Counting sort of the array indices by size class; arrays of 0 or 1 element are left out.
+        std::array<size_t, N_BATCH_CLASSES + 1> class_begin {};
+        for (size_t i {0}; i < n_arrays; i++)
+            if (offsets[i + 1] - offsets[i] > 1)
+                class_begin[class_of(i) + 1]++;
+        std::partial_sum(class_begin.begin(), class_begin.end(), class_begin.begin());
+        std::vector<std::uint32_t> ids(class_begin.back());
+        auto next {class_begin};
+        for (size_t i {0}; i < n_arrays; i++)
+            if (offsets[i + 1] - offsets[i] > 1)
+                ids[next[class_of(i)]++] = static_cast<std::uint32_t>(i);
+
+        bool simd {false};
+        if constexpr (uses_simd_network<Compare, ValueType>::value)
+            simd = network_isa() >= NetworkIsa::SSE4;
+        auto sort_batch = [=, &ids](size_t c, size_t begin, size_t end) {
+            auto batch {ids.data() + begin};
+            auto count {end - begin};
+            if constexpr (uses_simd_network<Compare, ValueType>::value) {
+                if (simd) {
+                    switch (c) {
+                        case 0: batch_sort_class<8>(values, offsets, batch, count); return;
+                        case 1: batch_sort_class<16>(values, offsets, batch, count); return;
+                        case 2: batch_sort_class<32>(values, offsets, batch, count); return;
+                        case 3: batch_sort_class<NETWORK_MAX_SIZE>(values, offsets, batch, count); return;
+                        case 4:
+                            for (size_t b {0}; b < count; b++)
+                                batch_sort_blocks(values + offsets[batch[b]], values + offsets[batch[b] + 1]);
+                            return;
+                        default: break;
+                    }
+                }
+            }
+            for (size_t b {0}; b < count; b++) {
+                auto first {values + offsets[batch[b]]};
+                auto last {values + offsets[batch[b] + 1]};
+                if (last - first <= NETWORK_MAX_SIZE)
+                    small_sort(first, last, cmp);
+                else
+                    quick(first, last, cmp);
+            }
+        };
+
+        TaskGroup group{pool};
+        for (size_t c {0}; c < N_BATCH_CLASSES; c++) {
+            // Batches of about BATCH_TASK_ELEMENTS elements, counting the longer arrays as 1024.
+            auto class_width {c < std::size(BATCH_CLASS_SIZES) ? BATCH_CLASS_SIZES[c] : 16 * NETWORK_MAX_SIZE};
+            auto per_batch {static_cast<size_t>(std::max<std::ptrdiff_t>(1, BATCH_TASK_ELEMENTS / class_width))};
+            for (auto begin {class_begin[c]}; begin < class_begin[c + 1]; begin += per_batch) {
+                auto end {std::min(begin + per_batch, class_begin[c + 1])};
+                if (pool.size() == 1)
+                    sort_batch(c, begin, end);
+                else
+                    group.run([=] { sort_batch(c, begin, end); });
+            }
+        }
+        group.wait();
+    }
+
+    /// Batched sort running on the `default_pool()`.
+    template< typename RandomIt, typename OffsetIt, typename Compare >
+    void batch_sort(RandomIt values, OffsetIt offsets, size_t n_arrays, Compare cmp){
+        batch_sort(values, offsets, n_arrays, cmp, default_pool());
+    }
+    //}}} BATCHED SORT
+
+    //{{{ INDIRECT SORT
+    /**
+     * @brief Rearranges [first, last) so that position i receives the element that was at
+     * position `perm[i]`, following the cycles of the permutation with a single temporary.
+     * Every element is moved once, plus once per cycle. The permutation is consumed: it
+     * is left as the identity.
+     *
+     * @tparam RandomIt iterator type
+     * @tparam IndexIt iterator type of the permutation
+     * @param first iterator to the beggining of the range to be rearranged
+     * @param last iterator to the position after the end of the range to be rearranged
+     * @param perm iterator to the beggining of the permutation, as long as the range
+     */
+    template< typename RandomIt, typename IndexIt >
+    void apply_permutation(RandomIt first, RandomIt last, IndexIt perm){
+        using Index = typename std::iterator_traits<IndexIt>::value_type;
+        Index n {static_cast<Index>(std::distance(first, last))};
+        for (Index start {0}; start < n; start++) {
+            if (perm[start] == start)
+                continue;
+            auto temp {std::move(first[start])};
+            auto hole {start};
+            for (auto source {perm[hole]}; source != start; source = perm[hole]) {
+                first[hole] = std::move(first[source]);
+                perm[hole] = hole;
+                hole = source;
+            }
+            first[hole] = std::move(temp);
+            perm[hole] = hole;
+        }
+    }
+
+    /// A key extracted from an element, and the position of that element.
+    template< typename Key, typename Index >
+    struct KeyIndex {
+        Key key;
+        Index index;
+    };
+
+    /// `sort_by_key` with indices of type `Index`, wide enough for the range.
+    template< typename Index, typename RandomIt, typename KeyOf, typename Compare >
+    void sort_by_key_as(RandomIt first, RandomIt last, KeyOf key_of, Compare cmp){
+        using Key = std::decay_t<decltype(key_of(*first))>;
+        using Pair = KeyIndex<Key, Index>;
+        vector<Pair> pairs;
+        pairs.reserve(std::distance(first, last));
+        for (auto it {first}; it != last; ++it)
+            pairs.push_back(Pair{key_of(*it), static_cast<Index>(it - first)});
+        merge_buffered(pairs.begin(), pairs.end(), [cmp](const Pair& a, const Pair& b) {
+            return cmp(a.key, b.key);
+        });
+        vector<Index> perm;
+        perm.reserve(pairs.size());
+        for (const auto& pair : pairs)
+            perm.push_back(pair.index);
+        pairs = vector<Pair>{};
+        apply_permutation(first, last, perm.begin());
+    }
+
+    /**
+     * @brief Sorts [first, last) by the keys `key_of` extracts, touching the elements only
+     * twice: once to extract the keys and once to put every element in its place.
+     *
+     * The (key, index) pairs are sorted with `merge_buffered`, so only small pairs move
+     * during the sort, and the elements are then rearranged with `apply_permutation`. This
+     * beats sorting large records directly, whose cost is dominated by moving them around.
+     * Indices are 32 bits wide when the range allows it. The sort is stable.
+     *
+     * @tparam RandomIt iterator type
+     * @tparam KeyOf type of the function extracting the key of an element
+     * @tparam Compare type of predicate to compare keys
+     * @param first iterator to the beggining of the range to be sorted
+     * @param last iterator to the position after the end of the range to be sorted
+     * @param key_of function that returns the key of an element
+     * @param cmp predicate that returns true if the first key is less than the second
+     */
+    template< typename RandomIt, typename KeyOf, typename Compare >
+    void sort_by_key(RandomIt first, RandomIt last, KeyOf key_of, Compare cmp){
+        if (static_cast<std::uint64_t>(std::distance(first, last)) <= std::numeric_limits<std::uint32_t>::max())
+            sort_by_key_as<std::uint32_t>(first, last, key_of, cmp);
+        else
+            sort_by_key_as<size_t>(first, last, key_of, cmp);
+    }
+
+    /**
+     * @brief Returns the permutation that sorts [first, last), leaving the range untouched:
+     * `first[perm[0]]`, `first[perm[1]]`, ... is in non-decreasing order. Only the indices
+     * move, sorted with `merge_buffered`, so the result is stable. Pass it to
+     * `apply_permutation` to sort the range itself.
+     *
+     * @tparam RandomIt iterator type
+     * @tparam Compare type of predicate to compare objects
+     * @param first iterator to the beggining of the range
+     * @param last iterator to the position after the end of the range
+     * @param cmp predicate that returns true if the first argument is less than the second
+     * @return The sorting permutation.
+     */
+    template< typename RandomIt, typename Compare >
+    vector<size_t> argsort(RandomIt first, RandomIt last, Compare cmp){
+        vector<size_t> perm(std::distance(first, last));
+        std::iota(perm.begin(), perm.end(), size_t{0});
+        merge_buffered(perm.begin(), perm.end(), [first, cmp](size_t a, size_t b) {
+            return cmp(first[a], first[b]);
+        });
+        return perm;
+    }
+    //}}} INDIRECT SORT
 };
 #endif // SORTING_H
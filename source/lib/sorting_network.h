@@ -0,0 +1,413 @@
+/**
+ * Sorting-network kernels for small blocks (up to 64 elements), used as the leaf case
+ * of the recursive sorts. `int32`, `int64` and `float` keys are sorted in SIMD registers
+ * (AVX2 or SSE4, chosen at runtime); anything else runs a scalar network.
+ * @author
+ * @date July 5th, 2021
+ * @file sorting_network.h
+ */
+
+#ifndef SORTING_NETWORK_H
+#define SORTING_NETWORK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <algorithm>
+#include <atomic>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SA_NETWORK_X86 1
+#include <immintrin.h>
+#else
+#define SA_NETWORK_X86 0
+#endif
+
+namespace sa { // sa = sorting algorithms
+    /// Largest block a sorting network sorts in one go.
+    constexpr std::ptrdiff_t NETWORK_MAX_SIZE {64};
+
+    /// Instruction sets the sorting networks can run on, from the least to the most capable.
+    enum class NetworkIsa {
+        NONE,   //!< Networks disabled: the recursive sorts use insertion sort as their leaf case.
+        SCALAR, //!< Branch-free scalar compare-exchanges.
+        SSE4,   //!< 128-bit registers (SSE 4.2).
+        AVX2,   //!< 256-bit registers.
+    };
+
+#if SA_NETWORK_X86
+    //{{{ SIMD KERNELS
+    // Every function in this region is compiled for AVX2.
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+    namespace network_avx2 {
+        struct I32 {
+            using value_type = std::int32_t;
+            using reg = __m256i;
+            static constexpr int LANES {8};
+            static reg load(const value_type* p) { return _mm256_loadu_si256(reinterpret_cast<const reg*>(p)); }
+            static void store(value_type* p, reg x) { _mm256_storeu_si256(reinterpret_cast<reg*>(p), x); }
+            static reg min(reg a, reg b) { return _mm256_min_epi32(a, b); }
+            static reg max(reg a, reg b) { return _mm256_max_epi32(a, b); }
+            static reg reverse(reg x) { return _mm256_permutevar8x32_epi32(x, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0)); }
+            template< int J > static reg swap_distance(reg x) {
+                if constexpr (J == 1) return _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1));
+                else if constexpr (J == 2) return _mm256_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2));
+                else return _mm256_permute2x128_si256(x, x, 1);
+            }
+            template< int M > static reg reverse_within(reg x) {
+                if constexpr (M == 2) return _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1));
+                else if constexpr (M == 4) return _mm256_shuffle_epi32(x, _MM_SHUFFLE(0, 1, 2, 3));
+                else return reverse(x);
+            }
+            template< int J > static reg blend_upper(reg lo, reg hi) {
+                if constexpr (J == 1) return _mm256_blend_epi32(lo, hi, 0xAA);
+                else if constexpr (J == 2) return _mm256_blend_epi32(lo, hi, 0xCC);
+                else return _mm256_blend_epi32(lo, hi, 0xF0);
+            }
+        };
+
+        struct I64 {
+            using value_type = std::int64_t;
+            using reg = __m256i;
+            static constexpr int LANES {4};
+            static reg load(const value_type* p) { return _mm256_loadu_si256(reinterpret_cast<const reg*>(p)); }
+            static void store(value_type* p, reg x) { _mm256_storeu_si256(reinterpret_cast<reg*>(p), x); }
+            // AVX2 has no 64-bit min/max: compare and blend.
+            static reg min(reg a, reg b) { return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b)); }
+            static reg max(reg a, reg b) { return _mm256_blendv_epi8(b, a, _mm256_cmpgt_epi64(a, b)); }
+            static reg reverse(reg x) { return _mm256_permute4x64_epi64(x, _MM_SHUFFLE(0, 1, 2, 3)); }
+            template< int J > static reg swap_distance(reg x) {
+                if constexpr (J == 1) return _mm256_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2));
+                else return _mm256_permute4x64_epi64(x, _MM_SHUFFLE(1, 0, 3, 2));
+            }
+            template< int M > static reg reverse_within(reg x) {
+                if constexpr (M == 2) return swap_distance<1>(x);
+                else return reverse(x);
+            }
+            template< int J > static reg blend_upper(reg lo, reg hi) {
+                if constexpr (J == 1) return _mm256_blend_epi32(lo, hi, 0xCC);
+                else return _mm256_blend_epi32(lo, hi, 0xF0);
+            }
+        };
+
+        struct F32 {
+            using value_type = float;
+            using reg = __m256;
+            static constexpr int LANES {8};
+            static reg load(const value_type* p) { return _mm256_loadu_ps(p); }
+            static void store(value_type* p, reg x) { _mm256_storeu_ps(p, x); }
+            static reg min(reg a, reg b) { return _mm256_min_ps(a, b); }
+            static reg max(reg a, reg b) { return _mm256_max_ps(a, b); }
+            static reg reverse(reg x) { return _mm256_permutevar8x32_ps(x, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0)); }
+            template< int J > static reg swap_distance(reg x) {
+                if constexpr (J == 1) return _mm256_permute_ps(x, _MM_SHUFFLE(2, 3, 0, 1));
+                else if constexpr (J == 2) return _mm256_permute_ps(x, _MM_SHUFFLE(1, 0, 3, 2));
+                else return _mm256_permute2f128_ps(x, x, 1);
+            }
+            template< int M > static reg reverse_within(reg x) {
+                if constexpr (M == 2) return _mm256_permute_ps(x, _MM_SHUFFLE(2, 3, 0, 1));
+                else if constexpr (M == 4) return _mm256_permute_ps(x, _MM_SHUFFLE(0, 1, 2, 3));
+                else return reverse(x);
+            }
+            template< int J > static reg blend_upper(reg lo, reg hi) {
+                if constexpr (J == 1) return _mm256_blend_ps(lo, hi, 0xAA);
+                else if constexpr (J == 2) return _mm256_blend_ps(lo, hi, 0xCC);
+                else return _mm256_blend_ps(lo, hi, 0xF0);
+            }
+        };
+
+#include "bitonic_network.inc"
+    };
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+    // Every function in this region is compiled for SSE 4.2.
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("sse4.2"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("sse4.2")
+#endif
+    namespace network_sse4 {
+        struct I32 {
+            using value_type = std::int32_t;
+            using reg = __m128i;
+            static constexpr int LANES {4};
+            static reg load(const value_type* p) { return _mm_loadu_si128(reinterpret_cast<const reg*>(p)); }
+            static void store(value_type* p, reg x) { _mm_storeu_si128(reinterpret_cast<reg*>(p), x); }
+            static reg min(reg a, reg b) { return _mm_min_epi32(a, b); }
+            static reg max(reg a, reg b) { return _mm_max_epi32(a, b); }
+            static reg reverse(reg x) { return _mm_shuffle_epi32(x, _MM_SHUFFLE(0, 1, 2, 3)); }
+            template< int J > static reg swap_distance(reg x) {
+                if constexpr (J == 1) return _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1));
+                else return _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2));
+            }
+            template< int M > static reg reverse_within(reg x) {
+                if constexpr (M == 2) return swap_distance<1>(x);
+                else return reverse(x);
+            }
+            template< int J > static reg blend_upper(reg lo, reg hi) {
+                if constexpr (J == 1) return _mm_blend_epi16(lo, hi, 0xCC);
+                else return _mm_blend_epi16(lo, hi, 0xF0);
+            }
+        };
+
+        struct I64 {
+            using value_type = std::int64_t;
+            using reg = __m128i;
+            static constexpr int LANES {2};
+            static reg load(const value_type* p) { return _mm_loadu_si128(reinterpret_cast<const reg*>(p)); }
+            static void store(value_type* p, reg x) { _mm_storeu_si128(reinterpret_cast<reg*>(p), x); }
+            static reg min(reg a, reg b) { return _mm_blendv_epi8(a, b, _mm_cmpgt_epi64(a, b)); }
+            static reg max(reg a, reg b) { return _mm_blendv_epi8(b, a, _mm_cmpgt_epi64(a, b)); }
+            static reg reverse(reg x) { return _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2)); }
+            template< int J > static reg swap_distance(reg x) { return reverse(x); }
+            template< int M > static reg reverse_within(reg x) { return reverse(x); }
+            template< int J > static reg blend_upper(reg lo, reg hi) { return _mm_blend_epi16(lo, hi, 0xF0); }
+        };
+
+        struct F32 {
+            using value_type = float;
+            using reg = __m128;
+            static constexpr int LANES {4};
+            static reg load(const value_type* p) { return _mm_loadu_ps(p); }
+            static void store(value_type* p, reg x) { _mm_storeu_ps(p, x); }
+            static reg min(reg a, reg b) { return _mm_min_ps(a, b); }
+            static reg max(reg a, reg b) { return _mm_max_ps(a, b); }
+            static reg reverse(reg x) { return _mm_shuffle_ps(x, x, _MM_SHUFFLE(0, 1, 2, 3)); }
+            template< int J > static reg swap_distance(reg x) {
+                if constexpr (J == 1) return _mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 3, 0, 1));
+                else return _mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 0, 3, 2));
+            }
+            template< int M > static reg reverse_within(reg x) {
+                if constexpr (M == 2) return swap_distance<1>(x);
+                else return reverse(x);
+            }
+            template< int J > static reg blend_upper(reg lo, reg hi) {
+                if constexpr (J == 1) return _mm_blend_ps(lo, hi, 0xA);
+                else return _mm_blend_ps(lo, hi, 0xC);
+            }
+        };
+
+#include "bitonic_network.inc"
+    };
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+    //}}} SIMD KERNELS
+#endif // SA_NETWORK_X86
+
+    //{{{ DISPATCH
+    /// Most capable instruction set supported by the running CPU.
+    inline NetworkIsa detect_network_isa() {
+#if SA_NETWORK_X86
+        if (__builtin_cpu_supports("avx2"))
+            return NetworkIsa::AVX2;
+        if (__builtin_cpu_supports("sse4.2"))
+            return NetworkIsa::SSE4;
+#endif
+        return NetworkIsa::SCALAR;
+    }
+
+    /// Atomic so that pool threads may read it while another thread changes it between sorts.
+    inline std::atomic<NetworkIsa>& network_isa_setting() {
+        static std::atomic<NetworkIsa> isa {detect_network_isa()};
+        return isa;
+    }
+
+    /// Instruction set currently used by the sorting networks.
+    inline NetworkIsa network_isa() {
+        return network_isa_setting().load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Selects the instruction set of the sorting networks (e.g. to compare them, or
+     * `NONE` to go back to insertion sort leaves). Instruction sets the CPU lacks are
+     * lowered to the best supported one. A sort already running may see either setting.
+     */
+    inline void set_network_isa(NetworkIsa isa) {
+        network_isa_setting().store(std::min(isa, detect_network_isa()), std::memory_order_relaxed);
+    }
+
+    /// Selects an instruction set for the lifetime of the object, then restores the previous one.
+    class ScopedNetworkIsa {
+        NetworkIsa previous;
+
+    public:
+        explicit ScopedNetworkIsa(NetworkIsa isa) : previous{network_isa()} {
+            set_network_isa(isa);
+        }
+        ScopedNetworkIsa(const ScopedNetworkIsa&) = delete;
+        ScopedNetworkIsa& operator=(const ScopedNetworkIsa&) = delete;
+        ~ScopedNetworkIsa() {
+            set_network_isa(previous);
+        }
+    };
+
+    /// Maps the element type onto the key type of the SIMD kernels (`void` if there is none).
+    template< typename T >
+    using network_key_t = std::conditional_t<
+        std::is_same<T, float>::value, float,
+        std::conditional_t<std::is_integral<T>::value and std::is_signed<T>::value and sizeof(T) == 4, std::int32_t,
+        std::conditional_t<std::is_integral<T>::value and std::is_signed<T>::value and sizeof(T) == 8, std::int64_t,
+        void>>>;
+
+    /// True when the SIMD kernels can sort `T` under `Compare`: a supported key and plain `<`.
+    template< typename Compare, typename T >
+    struct uses_simd_network : std::integral_constant<bool,
+        not std::is_void<network_key_t<T>>::value and
+        (std::is_same<Compare, std::less<T>>::value or std::is_same<Compare, std::less<>>::value)> {};
+
+    /**
+     * @brief Scalar sorting network on the `n` (at most `NETWORK_MAX_SIZE`) elements at `first`.
+     *
+     * Same comparator schedule as the SIMD kernels, on the next power of two: the missing
+     * elements act as +infinity at the end, so every comparator that touches them is a
+     * no-op and is simply skipped. Arithmetic values are compare-exchanged without branches.
+     */
+    template< typename RandomIt, typename Compare >
+    void scalar_network(RandomIt first, std::ptrdiff_t n, Compare cmp) {
+        using ValueType = typename std::iterator_traits<RandomIt>::value_type;
+        auto compare_exchange = [first, cmp](std::ptrdiff_t i, std::ptrdiff_t j) {
+            if constexpr (std::is_arithmetic<ValueType>::value) {
+                ValueType a {first[i]}, b {first[j]};
+                bool swap {cmp(b, a)};
+                first[i] = swap ? b : a;
+                first[j] = swap ? a : b;
+            } else if (cmp(first[j], first[i])) {
+                std::iter_swap(first + i, first + j);
+            }
+        };
+        std::ptrdiff_t size {1};
+        while (size < n)
+            size *= 2;
+        for (std::ptrdiff_t k {1}; k < size; k *= 2) {
+            for (std::ptrdiff_t block {0}; block < n; block += 2 * k)
+                for (std::ptrdiff_t t {0}; t < k; t++)
+                    if (block + 2 * k - 1 - t < n)
+                        compare_exchange(block + t, block + 2 * k - 1 - t);
+            for (auto j {k / 2}; j >= 1; j /= 2)
+                for (std::ptrdiff_t i {0}; i + j < n; i++)
+                    if ((i & j) == 0)
+                        compare_exchange(i, i + j);
+        }
+    }
+
+    /**
+     * @brief Sorts the `n` (at most `NETWORK_MAX_SIZE`) keys at `first` with the SIMD kernel
+     * of the current instruction set. The keys are copied to a block padded with the largest
+     * key up to 8, 16, 32 or 64 elements, sorted in registers and copied back.
+     */
+    template< typename RandomIt >
+    void simd_network(RandomIt first, std::ptrdiff_t n) {
+        using ValueType = typename std::iterator_traits<RandomIt>::value_type;
+        using Key = network_key_t<ValueType>;
+        alignas(32) Key keys[NETWORK_MAX_SIZE];
+        int size {8};
+        while (size < n)
+            size *= 2;
+        std::copy(first, first + n, keys);
+        std::fill(keys + n, keys + size, std::numeric_limits<Key>::has_infinity
+                  ? std::numeric_limits<Key>::infinity() : std::numeric_limits<Key>::max());
+
+        switch (network_isa()) {
+#if SA_NETWORK_X86
+            case NetworkIsa::AVX2:
+                if constexpr (std::is_same<Key, std::int32_t>::value) network_avx2::sort_block<network_avx2::I32>(keys, size);
+                else if constexpr (std::is_same<Key, std::int64_t>::value) network_avx2::sort_block<network_avx2::I64>(keys, size);
+                else network_avx2::sort_block<network_avx2::F32>(keys, size);
+                break;
+            case NetworkIsa::SSE4:
+                if constexpr (std::is_same<Key, std::int32_t>::value) network_sse4::sort_block<network_sse4::I32>(keys, size);
+                else if constexpr (std::is_same<Key, std::int64_t>::value) network_sse4::sort_block<network_sse4::I64>(keys, size);
+                else network_sse4::sort_block<network_sse4::F32>(keys, size);
+                break;
+#endif
+            default:
+                scalar_network(keys, n, std::less<Key>{});
+                break;
+        }
+        std::copy(keys, keys + n, first);
+    }
+
+    /**
+     * @brief Sorts a block of at most `NETWORK_MAX_SIZE` elements with a sorting network:
+     * in SIMD registers when `uses_simd_network` holds and the instruction set allows it,
+     * with the scalar network otherwise.
+     */
+    template< typename RandomIt, typename Compare >
+    void network_sort_block(RandomIt first, RandomIt last, Compare cmp) {
+        using ValueType = typename std::iterator_traits<RandomIt>::value_type;
+        auto n {std::distance(first, last)};
+        if (n <= 1)
+            return;
+        if constexpr (uses_simd_network<Compare, ValueType>::value) {
+            if (network_isa() >= NetworkIsa::SSE4) {
+                simd_network(first, n);
+                return;
+            }
+        }
+        scalar_network(first, n, cmp);
+    }
+
+    /**
+     * @brief Sorts `count` blocks of at most `Width` (8, 16, 32 or 64) keys with the SIMD
+     * kernel of that width, block `b` being [first + bounds(b).first, first + bounds(b).second).
+     *
+     * The batch version of `simd_network`: the instruction set is dispatched once for all
+     * the blocks, and every block is padded to `Width`, so each one runs the same
+     * comparators. Requires `uses_simd_network` and at least `NetworkIsa::SSE4`.
+     */
+    template< int Width, typename RandomIt, typename Bounds >
+    void simd_network_blocks(RandomIt first, size_t count, Bounds bounds) {
+        using ValueType = typename std::iterator_traits<RandomIt>::value_type;
+        using Key = network_key_t<ValueType>;
+        static_assert(Width >= 8 and Width <= NETWORK_MAX_SIZE and (Width & (Width - 1)) == 0, "no kernel of this width");
+        alignas(32) Key keys[Width];
+        auto each_block = [&](auto sort) {
+            for (size_t b {0}; b < count; b++) {
+                auto [begin, end] = bounds(b);
+                std::copy(first + begin, first + end, keys);
+                std::fill(keys + (end - begin), keys + Width, std::numeric_limits<Key>::has_infinity
+                          ? std::numeric_limits<Key>::infinity() : std::numeric_limits<Key>::max());
+                sort(keys);
+                std::copy(keys, keys + (end - begin), first + begin);
+            }
+        };
+        switch (network_isa()) {
+#if SA_NETWORK_X86
+            case NetworkIsa::AVX2:
+                if constexpr (std::is_same<Key, std::int32_t>::value) each_block([](Key* k) { network_avx2::sort_block<network_avx2::I32>(k, Width); });
+                else if constexpr (std::is_same<Key, std::int64_t>::value) each_block([](Key* k) { network_avx2::sort_block<network_avx2::I64>(k, Width); });
+                else each_block([](Key* k) { network_avx2::sort_block<network_avx2::F32>(k, Width); });
+                break;
+            case NetworkIsa::SSE4:
+                if constexpr (std::is_same<Key, std::int32_t>::value) each_block([](Key* k) { network_sse4::sort_block<network_sse4::I32>(k, Width); });
+                else if constexpr (std::is_same<Key, std::int64_t>::value) each_block([](Key* k) { network_sse4::sort_block<network_sse4::I64>(k, Width); });
+                else each_block([](Key* k) { network_sse4::sort_block<network_sse4::F32>(k, Width); });
+                break;
+#endif
+            default:
+                for (size_t b {0}; b < count; b++) {
+                    auto [begin, end] = bounds(b);
+                    scalar_network(first + begin, end - begin, std::less<Key>{});
+                }
+                break;
+        }
+    }
+    //}}} DISPATCH
+};
+#endif // SORTING_NETWORK_H
@@ -0,0 +1,341 @@
+/**
+ * Sorting of strings and other variable length keys, by character instead of by
+ * comparison: MSD radix sort, multikey quicksort and LCP merge sort, over ranges of
+ * `std::string_view`s into a StringArena (or of any contiguous string type, such as `std::string`).
+ *
+ * Strings are ordered byte-wise, as unsigned characters, a prefix before the strings it
+ * starts: the order of `std::string_view::compare`.
+ * @author
+ * @date July 5th, 2021
+ * @file string_sort.h
+ */
+
+#ifndef STRING_SORT_H
+#define STRING_SORT_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace sa { // sa = sorting algorithms
+    /**
+     * @brief Strings stored back to back in one buffer, so a set of them costs two
+     * allocations in all instead of one per string.
+     */
+    class StringArena {
+        std::vector<char> chars;
+        std::vector<std::pair<size_t, size_t>> spans; //!< Offset and length of each string.
+
+    public:
+        void reserve(size_t n_strings, size_t n_chars) {
+            spans.reserve(n_strings);
+            chars.reserve(n_chars);
+        }
+
+        /// Appends a copy of `s`.
+        void push_back(std::string_view s) {
+            spans.emplace_back(chars.size(), s.size());
+            chars.insert(chars.end(), s.begin(), s.end());
+        }
+
+        size_t size() const { return spans.size(); }
+        /// Characters over all strings.
+        size_t n_chars() const { return chars.size(); }
+
+        std::string_view operator[](size_t i) const {
+            return {chars.data() + spans[i].first, spans[i].second};
+        }
+
+        /// Views of every string, valid until the arena is next modified.
+        std::vector<std::string_view> views() const {
+            std::vector<std::string_view> out;
+            out.reserve(size());
+            for (size_t i {0}; i < size(); i++)
+                out.push_back((*this)[i]);
+            return out;
+        }
+    };
+
+    /// Strings sorted by `string_insertion` rather than split any further.
+    constexpr std::ptrdiff_t STRING_INSERTION_CUTOFF {16};
+    /// Below this many strings, `msd_string_radix` hands a bucket to multikey quicksort.
+    constexpr std::ptrdiff_t STRING_RADIX_CUTOFF {1 << 10};
+    /// Digits of the MSD radix sort: one per byte value, after 0 for the end of the string.
+    constexpr size_t STRING_RADIX_DIGITS {257};
+
+    /// Character `depth` of `s` as a digit: 0 past the end of `s`, the byte plus one otherwise.
+    template< typename String >
+    int char_at(const String& s, size_t depth) {
+        return depth < s.size() ? static_cast<unsigned char>(s[depth]) + 1 : 0;
+    }
+
+    /// Length of the common prefix of `a` and `b`, which share their first `depth` characters.
+    template< typename String >
+    size_t common_prefix(const String& a, const String& b, size_t depth) {
+        auto n {std::min<size_t>(a.size(), b.size())};
+        // A word at a time, then the bytes left.
+        for (; depth + sizeof(std::uint64_t) <= n; depth += sizeof(std::uint64_t)) {
+            std::uint64_t word_a, word_b;
+            std::memcpy(&word_a, a.data() + depth, sizeof word_a);
+            std::memcpy(&word_b, b.data() + depth, sizeof word_b);
+            if (word_a != word_b)
+                break;
+        }
+        while (depth < n and a[depth] == b[depth])
+            depth++;
+        return depth;
+    }
+
+    /// Length of the prefix common to all the strings of [first, last), which share their first `depth` characters.
+    template< typename RandomIt >
+    size_t shared_prefix(RandomIt first, RandomIt last, size_t depth) {
+        auto shared {first->size()};
+        for (auto i {first + 1}; i < last and shared > depth; i++)
+            shared = std::min(shared, common_prefix(*first, *i, depth));
+        return std::max(shared, depth);
+    }
+
+    /// Whether `a` goes before `b`, which share their first `depth` characters.
+    template< typename String >
+    bool string_less(const String& a, const String& b, size_t depth) {
+        auto d {common_prefix(a, b, depth)};
+        return d < b.size() and (d == a.size() or static_cast<unsigned char>(a[d]) < static_cast<unsigned char>(b[d]));
+    }
+
+    /// Insertion sort of strings sharing their first `depth` characters, compared from there on.
+    template< typename RandomIt >
+    void string_insertion(RandomIt first, RandomIt last, size_t depth) {
+        if (first == last)
+            return;
+        for (auto i {first + 1}; i < last; i++) {
+            auto value {std::move(*i)};
+            auto j {i};
+            for (; j != first and string_less(value, *(j - 1), depth); j--)
+                *j = std::move(*(j - 1));
+            *j = std::move(value);
+        }
+    }
+
+    //{{{ MULTIKEY QUICKSORT
+    /// Multikey quicksort of strings sharing their first `depth` characters.
+    template< typename RandomIt >
+    void multikey_quick_from(RandomIt first, RandomIt last, size_t depth) {
+        while (last - first > STRING_INSERTION_CUTOFF) {
+            // Median of three characters.
+            auto n {last - first};
+            int a {char_at(first[0], depth)}, b {char_at(first[n / 2], depth)}, c {char_at(first[n - 1], depth)};
+            auto pivot {std::max(std::min(a, b), std::min(std::max(a, b), c))};
+
+            // Three-way partition on the character at `depth` (Dijkstra).
+            auto lt {first};
+            auto gt {last};
+            for (auto i {first}; i < gt;) {
+                auto ch {char_at(*i, depth)};
+                if (ch < pivot)
+                    std::iter_swap(lt++, i++);
+                else if (ch > pivot)
+                    std::iter_swap(i, --gt);
+                else
+                    i++;
+            }
+            multikey_quick_from(first, lt, depth);
+            multikey_quick_from(gt, last, depth);
+            if (pivot == 0)
+                return; // equal strings, which all ended at `depth`
+            // The middle part shares one more character: go on with the next one, or past
+            // the whole prefix it shares when nothing was split off, as along a shared prefix.
+            auto unsplit {lt == first and gt == last};
+            first = lt;
+            last = gt;
+            depth = unsplit ? shared_prefix(first, last, depth + 1) : depth + 1;
+        }
+        string_insertion(first, last, depth);
+    }
+
+    /**
+     * @brief Multikey quicksort (Bentley and Sedgewick) of the strings in [first, last).
+     *
+     * A quicksort on one character at a time: the strings are split three ways on
+     * their character at the current depth, and only those equal to the pivot move on
+     * to the next character (or past the prefix they all share, when none were split
+     * off). No character is ever looked at twice after the split that
+     * settles it, so the cost is O(n log n + D), D being the distinguishing prefixes.
+     * Not stable.
+     *
+     * @tparam RandomIt iterator type over `std::string_view` or a similar string type
+     * @param first iterator to the beggining of the range to be sorted
+     * @param last iterator to the position after the end of the range to be sorted
+     */
+    template< typename RandomIt >
+    void multikey_quick(RandomIt first, RandomIt last){
+        multikey_quick_from(first, last, 0);
+    }
+    //}}} MULTIKEY QUICKSORT
+
+    //{{{ MSD STRING RADIX SORT
+    /// MSD radix sort of strings sharing their first `depth` characters; `buffer` has room for them.
+    template< typename RandomIt, typename BufferIt >
+    void msd_string_radix_from(RandomIt first, RandomIt last, BufferIt buffer, size_t depth) {
+        auto n {last - first};
+        if (n < STRING_RADIX_CUTOFF) {
+            multikey_quick_from(first, last, depth);
+            return;
+        }
+        // The digits are read once, for counting, and kept for the distribution.
+        std::vector<std::uint16_t> digits(n);
+        std::array<size_t, STRING_RADIX_DIGITS + 1> bucket {};
+        for (;;) {
+            bucket.fill(0);
+            for (std::ptrdiff_t i {0}; i < n; i++) {
+                digits[i] = static_cast<std::uint16_t>(char_at(first[i], depth));
+                bucket[digits[i] + 1]++;
+            }
+            // A single bucket moves nothing: go straight past the prefix all the strings share.
+            if (bucket[digits[0] + 1] != static_cast<size_t>(n) or digits[0] == 0)
+                break;
+            depth = shared_prefix(first, last, depth + 1);
+        }
+        for (size_t d {1}; d <= STRING_RADIX_DIGITS; d++)
+            bucket[d] += bucket[d - 1];
+        auto next {bucket};
+        for (std::ptrdiff_t i {0}; i < n; i++)
+            buffer[next[digits[i]]++] = std::move(first[i]);
+        std::move(buffer, buffer + n, first);
+        digits = {}; // not needed by the recursion
+
+        // Bucket 0 holds the strings that ended, already in place.
+        for (size_t d {1}; d < STRING_RADIX_DIGITS; d++)
+            if (bucket[d + 1] - bucket[d] > 1)
+                msd_string_radix_from(first + bucket[d], first + bucket[d + 1], buffer, depth + 1);
+    }
+
+    /**
+     * @brief MSD radix sort of the strings in [first, last), one byte per digit.
+     *
+     * Each pass distributes the strings into 257 buckets by their character at the
+     * current depth (reading it once), then sorts each bucket on the next character;
+     * buckets of fewer than `STRING_RADIX_CUTOFF` strings go to `multikey_quick`. When
+     * every string falls in the same bucket, the pass moves nothing and the sort skips
+     * to the end of the prefix they all share, a word at a time. Needs a buffer of one view per string.
+     *
+     * @tparam RandomIt iterator type over `std::string_view` or a similar string type
+     * @param first iterator to the beggining of the range to be sorted
+     * @param last iterator to the position after the end of the range to be sorted
+     */
+    template< typename RandomIt >
+    void msd_string_radix(RandomIt first, RandomIt last){
+        using ValueType = typename std::iterator_traits<RandomIt>::value_type;
+        std::vector<ValueType> buffer(std::distance(first, last));
+        msd_string_radix_from(first, last, buffer.begin(), 0);
+    }
+    //}}} MSD STRING RADIX SORT
+
+    //{{{ LCP MERGE SORT
+    /**
+     * @brief Merges two sorted runs of strings along with their LCP arrays, moving the strings.
+     *
+     * `a_lcp[i]` is the length of the common prefix of `a[i - 1]` and `a[i]` (`a_lcp[0]` is
+     * not read), and so for `b` and for the output. Each string is known to share some
+     * prefix with the string output last; whichever shares the longer one goes first,
+     * without looking at a character, and only on a tie are characters compared, from
+     * that common length on. Ties go to `a`, so the merge is stable.
+     */
+    template< typename InIt, typename OutIt >
+    void lcp_merge_runs(InIt a, const size_t* a_lcp, std::ptrdiff_t n_a, InIt b, const size_t* b_lcp, std::ptrdiff_t n_b,
+                        OutIt out, size_t* out_lcp) {
+        std::ptrdiff_t i {0}, j {0}, k {0};
+        size_t h_a {0}, h_b {0}; // common prefix of a[i] and b[j] with the last output string
+        auto take_a = [&] {
+            out_lcp[k] = h_a;
+            out[k++] = std::move(a[i++]);
+            h_a = i < n_a ? a_lcp[i] : 0;
+        };
+        auto take_b = [&] {
+            out_lcp[k] = h_b;
+            out[k++] = std::move(b[j++]);
+            h_b = j < n_b ? b_lcp[j] : 0;
+        };
+        while (i < n_a and j < n_b) {
+            if (h_a > h_b) {
+                take_a(); // b[j] still shares h_b with the string output
+            } else if (h_a < h_b) {
+                take_b();
+            } else {
+                auto h {common_prefix(a[i], b[j], h_a)};
+                if (h < a[i].size() and (h == b[j].size() or static_cast<unsigned char>(b[j][h]) < static_cast<unsigned char>(a[i][h]))) {
+                    take_b();
+                    h_a = h;
+                } else {
+                    take_a();
+                    h_b = h;
+                }
+            }
+        }
+        while (i < n_a)
+            take_a();
+        while (j < n_b)
+            take_b();
+    }
+
+    /**
+     * @brief Sorts the `n` strings at `data` with their LCP array into `data_lcp`, or into
+     * `scratch` and `scratch_lcp` when `into_data` is false, ping-ponging between the two
+     * as `merge_sort_to` does.
+     */
+    template< typename RandomIt, typename BufferIt >
+    void lcp_merge_sort_to(RandomIt data, size_t* data_lcp, BufferIt scratch, size_t* scratch_lcp, std::ptrdiff_t n, bool into_data) {
+        if (n <= STRING_INSERTION_CUTOFF) {
+            string_insertion(data, data + n, 0);
+            data_lcp[0] = 0;
+            for (std::ptrdiff_t i {1}; i < n; i++)
+                data_lcp[i] = common_prefix(data[i - 1], data[i], 0);
+            if (not into_data) {
+                std::move(data, data + n, scratch);
+                std::copy(data_lcp, data_lcp + n, scratch_lcp);
+            }
+            return;
+        }
+        auto half {n / 2};
+        lcp_merge_sort_to(data, data_lcp, scratch, scratch_lcp, half, not into_data);
+        lcp_merge_sort_to(data + half, data_lcp + half, scratch + half, scratch_lcp + half, n - half, not into_data);
+        if (into_data)
+            lcp_merge_runs(scratch, scratch_lcp, half, scratch + half, scratch_lcp + half, n - half, data, data_lcp);
+        else
+            lcp_merge_runs(data, data_lcp, half, data + half, data_lcp + half, n - half, scratch, scratch_lcp);
+    }
+
+    /**
+     * @brief LCP merge sort (Ng and Kakehi) of the strings in [first, last).
+     *
+     * A top-down merge sort whose runs carry the longest common prefix (LCP) of each
+     * string with the one before it. The merges use them to skip the prefixes already
+     * known to be equal, so no character is compared twice in a merge and the cost is
+     * O(n log n + D), D being the distinguishing prefixes. Stable, and returns the LCP
+     * array of the sorted strings.
+     *
+     * @tparam RandomIt iterator type over `std::string_view` or a similar string type
+     * @param first iterator to the beggining of the range to be sorted
+     * @param last iterator to the position after the end of the range to be sorted
+     * @return the LCP array: element i is the common prefix length of strings i - 1 and i (0 for i = 0)
+     */
+    template< typename RandomIt >
+    std::vector<size_t> lcp_merge(RandomIt first, RandomIt last){
+        using ValueType = typename std::iterator_traits<RandomIt>::value_type;
+        auto n {std::distance(first, last)};
+        std::vector<size_t> lcp(n), scratch_lcp(n);
+        if (n == 0)
+            return lcp;
+        std::vector<ValueType> scratch(n);
+        lcp_merge_sort_to(first, lcp.data(), scratch.begin(), scratch_lcp.data(), n, true);
+        return lcp;
+    }
+    //}}} LCP MERGE SORT
+};
+
+#endif // STRING_SORT_H
@@ -0,0 +1,207 @@
+/**
+ * A small work-stealing thread pool used by the parallel sorting algorithms.
+ * @author
+ * @date July 5th, 2021
+ * @file thread_pool.h
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace sa { // sa = sorting algorithms
+    /**
+     * @brief Fixed-size pool of worker threads with one task deque per worker.
+     *
+     * A worker pops tasks from the back of its own deque (LIFO, cache friendly for
+     * divide-and-conquer) and, when it runs dry, steals from the front of the others.
+     * The thread that waits on a TaskGroup also executes pending tasks, so a pool built
+     * for `n` threads spawns only `n - 1` workers: the caller is the n-th one.
+     */
+    class ThreadPool {
+        using Task = std::function<void()>;
+
+        struct TaskQueue {
+            std::mutex mtx;
+            std::deque<Task> tasks;
+        };
+
+        std::vector<std::unique_ptr<TaskQueue>> queues;
+        std::vector<std::thread> workers;
+        std::atomic<size_t> n_queued{0};  //!< Tasks pushed but not yet popped.
+        std::atomic<size_t> next_queue{0}; //!< Round robin index for external submissions.
+        std::atomic<bool> stopping{false};
+        std::mutex sleep_mtx;
+        std::condition_variable wake;
+
+        /// Identifies which pool (if any) the current thread works for, and its queue.
+        struct WorkerId {
+            const ThreadPool* pool{nullptr};
+            size_t index{0};
+        };
+        static WorkerId& this_worker() {
+            static thread_local WorkerId id;
+            return id;
+        }
+
+        bool pop_from(size_t index, bool back, Task& task) {
+            auto& q {*queues[index]};
+            std::lock_guard<std::mutex> lock{q.mtx};
+            if (q.tasks.empty())
+                return false;
+            if (back) {
+                task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+            } else {
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+            }
+            n_queued--;
+            return true;
+        }
+
+        void worker_loop(size_t index) {
+            this_worker() = WorkerId{this, index};
+            while (not stopping) {
+                if (run_pending())
+                    continue;
+                std::unique_lock<std::mutex> lock{sleep_mtx};
+                wake.wait(lock, [this] { return stopping or n_queued > 0; });
+            }
+        }
+
+    public:
+        /// Creates a pool that runs at most `n_threads` tasks at once (caller included).
+        explicit ThreadPool(size_t n_threads = std::thread::hardware_concurrency()) {
+            if (n_threads == 0)
+                n_threads = 1;
+            auto n_workers {n_threads - 1};
+            auto n_queues {n_workers > 0 ? n_workers : 1};
+            for (size_t i {0}; i < n_queues; i++)
+                queues.push_back(std::make_unique<TaskQueue>());
+            for (size_t i {0}; i < n_workers; i++)
+                workers.emplace_back([this, i] { worker_loop(i); });
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        ~ThreadPool() {
+            {
+                std::lock_guard<std::mutex> lock{sleep_mtx};
+                stopping = true;
+            }
+            wake.notify_all();
+            for (auto& w : workers)
+                w.join();
+        }
+
+        /// Number of threads that can run tasks concurrently, the waiting caller included.
+        size_t size() const {
+            return workers.size() + 1;
+        }
+
+        /// Queues a task. Workers push onto their own deque, other threads spread round robin.
+        void submit(Task task) {
+            auto& me {this_worker()};
+            auto index {me.pool == this ? me.index : next_queue++ % queues.size()};
+            {
+                std::lock_guard<std::mutex> lock{queues[index]->mtx};
+                queues[index]->tasks.push_back(std::move(task));
+                n_queued++;
+            }
+            {
+                // Taking the lock orders this wake up after a sleeper's predicate check.
+                std::lock_guard<std::mutex> lock{sleep_mtx};
+            }
+            wake.notify_one();
+        }
+
+        /// Runs one pending task, own deque first and then stealing. Returns false if there was none.
+        bool run_pending() {
+            if (n_queued == 0)
+                return false;
+            auto& me {this_worker()};
+            auto own {me.pool == this ? me.index : 0};
+            Task task;
+            if (me.pool == this and pop_from(own, true, task)) {
+                task();
+                return true;
+            }
+            for (size_t k {0}; k < queues.size(); k++) {
+                auto victim {(own + k) % queues.size()};
+                if (pop_from(victim, false, task)) {
+                    task();
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    /**
+     * @brief Fork-join helper: spawns tasks into a pool and waits for all of them.
+     *
+     * While waiting, the calling thread keeps executing pending tasks, so nested groups
+     * never deadlock, even in a pool with a single thread.
+     */
+    class TaskGroup {
+        ThreadPool& pool;
+        std::atomic<size_t> pending{0};
+        std::mutex error_mtx;
+        std::exception_ptr error;
+
+    public:
+        explicit TaskGroup(ThreadPool& pool) : pool{pool} {}
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+        ~TaskGroup() {
+            while (pending > 0)
+                if (not pool.run_pending())
+                    std::this_thread::yield();
+        }
+
+        /// Submits `f` to the pool as part of this group.
+        template <typename Function>
+        void run(Function f) {
+            pending++;
+            pool.submit([this, f]() mutable {
+                try {
+                    f();
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock{error_mtx};
+                    if (not error)
+                        error = std::current_exception();
+                }
+                pending--;
+            });
+        }
+
+        /// Blocks until every task of the group finished; rethrows the first exception raised.
+        void wait() {
+            while (pending > 0)
+                if (not pool.run_pending())
+                    std::this_thread::yield();
+            if (error)
+                std::rethrow_exception(std::exchange(error, nullptr));
+        }
+    };
+
+    /// Pool shared by the parallel algorithms when the client does not provide one.
+    inline ThreadPool& default_pool() {
+        static ThreadPool pool;
+        return pool;
+    }
+};
+#endif // THREAD_POOL_H
@@ -17,9 +17,26 @@
 #include <bits/stdc++.h>
 #include <utility>
 #include <iterator>
+#include <thread>
+#include <cstring>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <optional>
 using std::function;
 
 #include "lib/sorting.h"
+#include "lib/external_sort.h"
+#include "lib/perf_counters.h"
+#include "lib/op_counter.h"
+#include "lib/benchmark.h"
+#include "lib/generators.h"
+#include "lib/string_sort.h"
+// This translation unit hosts the replacement operator new/delete.
+#define SA_MEMORY_HOOKS
+#include "lib/memory_tracker.h"
 
 //=== ALIASES
 
@@ -60,22 +77,67 @@ struct RunningOpt{
     size_t min_sample_sz{1000};  //!< Default 10^5.
     size_t max_sample_sz{50000}; //!< The max sample size.
     int n_samples{25};           //!< The number of samples to collect.
+    std::uint64_t seed{1};       //!< Seed every input is derived from.
+    std::string cache_dir;       //!< Where generated inputs are cached; empty disables the cache.
+    size_t n_threads{std::thread::hardware_concurrency()}; //!< Threads used by the parallel algorithms.
+    size_t external_max_mb{0};   //!< Largest file of the external sort benchmark; 0 runs the in-memory one.
+    std::string temp_dir;        //!< Where the external sort benchmark puts its files.
+    bool kway{false};            //!< Runs the k-way merge benchmark instead of the sorting one.
+    size_t indirect_max_bytes{0}; //!< Largest record of the indirect sort benchmark; 0 skips it.
+    bool heavy{false};           //!< Runs the benchmark over heavy and move-only element types instead.
+    bool budget{false};          //!< Runs the bounded merge sort against its scratch budget instead.
+    bool select{false};          //!< Runs selection and top-k against full sorting instead.
+    bool batch{false};           //!< Runs the batched sort of many small arrays instead.
+    bool strings{false};         //!< Runs the string sorts against comparison sorts instead.
+    bool counters{false};        //!< Adds hardware counter columns next to the timings.
+    bool ops{false};             //!< Adds comparison, copy, move and swap counts next to the timings.
+    bool memory{false};          //!< Adds heap allocation and stack high-water columns next to the timings.
+    sa::bench::BenchOptions bench; //!< Warmup and repetitions of each measurement.
+    long pin_cpu{-1};            //!< First CPU the threads are pinned to; negative leaves them unpinned.
+    std::string output{"results"}; //!< Results go to <output>.csv and <output>.json.
+    std::vector<size_t> cores;   //!< CPUs the serial cells are spread over; empty runs every cell on the main thread.
+    unsigned cache_sweep{0};     //!< Sizes per octave of the cache hierarchy sweep; 0 keeps the linear sweep.
+    bool sizes_given{false};     //!< Whether the sample sizes came from the command line.
 
     /// Returns the sample size step, based on the [min,max] sample sizes and # of samples.
     size_type sample_step(void){
-        return static_cast<float>(max_sample_sz-min_sample_sz)/(n_samples-1);
+        if (n_samples < 2)
+            return 0;
+        return static_cast<double>(max_sample_sz-min_sample_sz)/(n_samples-1);
     }
 };
 
+/// Runs `sort` with the sorting network leaves switched off (insertion sort leaves instead).
+template <typename Sort>
+void without_networks(Sort sort) {
+    sa::ScopedNetworkIsa isa {sa::NetworkIsa::NONE};
+    sort();
+}
+
 enum AlgorithmCode {
     START_ALGR,
     BUBBLE,
     INSERTION,
     SELECTION,
     MERGE,
+    MERGE_BUFFERED,
+    MERGE_BOTTOM_UP,
+    MERGE_LESS,
+    MERGE_NETWORK,
+    PARALLEL_MERGE,
+    TIMSORT,
     SHELL,
+    SHELL_CIURA,
+    SHELL_TOKUDA,
+    SHELL_SEDGEWICK,
+    SHELL_PRATT,
     QUICK,
+    QUICK_LESS,
+    QUICK_NETWORK,
+    QUICK3,
+    PARALLEL_SAMPLE,
     RADIX,
+    PARALLEL_RADIX,
     END_ALGR,
 };
 
@@ -85,14 +147,30 @@ class AlgorithmCollection {
         "insertion",
         "selection",
         "merge",
+        "merge_buf",
+        "merge_bu",
+        "merge_less",
+        "merge_net",
+        "par_merge",
+        "timsort",
         "shell",
+        "shell_ciura",
+        "shell_tokuda",
+        "shell_sedgewick",
+        "shell_pratt",
         "quick",
+        "quick_less",
+        "quick_net",
+        "quick3",
+        "par_sample",
         "radix",
+        "par_radix",
     };
     AlgorithmCode curr_algorithm;
+    sa::ThreadPool& pool;
 
     public:
-        AlgorithmCollection() {
+        AlgorithmCollection(sa::ThreadPool& pool) : pool{pool} {
             curr_algorithm = START_ALGR;
             next();
         }
@@ -111,6 +189,18 @@ class AlgorithmCollection {
             return algorithms_names[curr_algorithm - 1];
         }
 
+        AlgorithmCode code() {
+            return curr_algorithm;
+        }
+
+        void select(AlgorithmCode code) {
+            curr_algorithm = code;
+        }
+
+        std::string name_of(AlgorithmCode code) {
+            return algorithms_names[code - 1];
+        }
+
         template <typename RandomIt, typename Compare>
         void call_curr(RandomIt first, RandomIt last, Compare cmp) {
             switch (curr_algorithm) {
@@ -126,15 +216,62 @@ class AlgorithmCollection {
                 case MERGE:
                     sa::merge(first, last, cmp);
                     break;
+                case MERGE_BUFFERED:
+                    sa::merge_buffered(first, last, cmp);
+                    break;
+                case MERGE_BOTTOM_UP:
+                    sa::merge_bottom_up(first, last, cmp);
+                    break;
+                // The *_less/*_net pairs compare with std::less, so the sorting network
+                // leaves can kick in; only the leaves differ between the two columns.
+                case MERGE_LESS:
+                    without_networks([&] { sa::merge_buffered(first, last, std::less<>{}); });
+                    break;
+                case MERGE_NETWORK:
+                    sa::merge_buffered(first, last, std::less<>{});
+                    break;
+                case PARALLEL_MERGE:
+                    sa::parallel_merge(first, last, cmp, pool);
+                    break;
+                case TIMSORT:
+                    sa::timsort(first, last, cmp);
+                    break;
                 case SHELL:
                     sa::shell(first, last, cmp);
                     break;
+                case SHELL_CIURA:
+                    sa::shell<RandomIt, Compare, sa::gaps::Ciura>(first, last, cmp);
+                    break;
+                case SHELL_TOKUDA:
+                    sa::shell<RandomIt, Compare, sa::gaps::Tokuda>(first, last, cmp);
+                    break;
+                case SHELL_SEDGEWICK:
+                    sa::shell<RandomIt, Compare, sa::gaps::Sedgewick>(first, last, cmp);
+                    break;
+                case SHELL_PRATT:
+                    sa::shell<RandomIt, Compare, sa::gaps::Pratt>(first, last, cmp);
+                    break;
                 case QUICK:
                     sa::quick(first, last, cmp);
                     break;
+                case QUICK_LESS:
+                    without_networks([&] { sa::quick(first, last, std::less<>{}); });
+                    break;
+                case QUICK_NETWORK:
+                    sa::quick(first, last, std::less<>{});
+                    break;
+                case QUICK3:
+                    sa::quick3(first, last, cmp);
+                    break;
+                case PARALLEL_SAMPLE:
+                    sa::parallel_sample(first, last, cmp, pool);
+                    break;
                 case RADIX:
                     sa::radix(first, last, cmp);
                     break;
+                case PARALLEL_RADIX:
+                    sa::parallel_radix(first, last, cmp, pool);
+                    break;
                 default: break;
 
             }
@@ -149,12 +286,21 @@ enum DataCode {
     SORTED_75,
     SORTED_50,
     SORTED_25,
+    FEW_UNIQUE,
+    ALL_EQUAL,
+    ZIPF,
     END_DATA,
 };
 
 class DataSet {
-    std::vector<int> data;
+    std::vector<value_type> data;
+    std::unique_ptr<sa::gen::MappedInput<value_type>> cached; //!< The current input, when it came from the cache.
+    const value_type* first {nullptr};
+    size_t n {0};
     DataCode curr_dataset;
+    std::uint64_t seed;
+    std::unique_ptr<sa::gen::DatasetCache> cache;
+    sa::ThreadPool& pool;
     const std::string names[END_DATA] {
         "non_decreasing",
         "non_increasing",
@@ -162,11 +308,21 @@ class DataSet {
         "sorted_75",
         "sorted_50",
         "sorted_25",
+        "few_unique",
+        "all_equal",
+        "zipf",
     };
+    /// Number of distinct keys in the FEW_UNIQUE scenario.
+    static constexpr int FEW_UNIQUE_KEYS{16};
+    /// Number of distinct keys (ranks) in the ZIPF scenario.
+    static constexpr int ZIPF_KEYS{1000};
+    /// Exponent of the ZIPF scenario: rank r is drawn with probability proportional to 1 / r^s.
+    static constexpr double ZIPF_EXPONENT{1.0};
 
     public:
-        DataSet(const RunningOpt& run_opt) {
-            data.reserve(run_opt.max_sample_sz);
+        DataSet(const RunningOpt& run_opt, sa::ThreadPool& pool) : seed{run_opt.seed}, pool{pool} {
+            if (not run_opt.cache_dir.empty())
+                cache = std::make_unique<sa::gen::DatasetCache>(run_opt.cache_dir);
             curr_dataset = START_DATA;
             next();
         }
@@ -175,6 +331,14 @@ class DataSet {
             curr_dataset = static_cast<DataCode>(curr_dataset + 1);
         }
 
+        void select(DataCode code) {
+            curr_dataset = code;
+        }
+
+        DataCode code() {
+            return curr_dataset;
+        }
+
         bool has_ended() {
             return curr_dataset >= END_DATA;
         }
@@ -186,155 +350,1277 @@ class DataSet {
         }
 
         void resize(size_t size) {
-            data.resize(size);
+            n = size;
         }
 
+        /// Generates (or maps from the cache) the input of the current scenario and size.
         void generate_data() {
-            std::default_random_engine generator;
-            generator.seed(std::chrono::system_clock::now().time_since_epoch().count());
-            bool sort_percent {false};
-            float percentage;
-
+            if (has_ended())
+                return;
+            // Each (scenario, size) input has its own seed, so it does not depend on what ran before it.
+            auto input_seed {sa::gen::derive_seed(seed, curr_dataset, n)};
+            cached.reset();
+            if (cache) {
+                try {
+                    cached = cache->load<value_type>(to_string(), input_seed, n);
+                } catch (const std::exception& e) {
+                    std::cerr << ">>> Ignoring the cached input: " << e.what() << '\n';
+                }
+                if (cached) {
+                    data = std::vector<value_type>{};
+                    first = cached->data();
+                    return;
+                }
+            }
+            data.resize(n);
+            auto out {data.data()};
             switch (curr_dataset) {
-                case NON_DECREASING: {
-                    std::uniform_int_distribution<int> distribution(0, INT_MAX / data.size());
-                    data[0] = distribution(generator);
-                    for (size_t i {1}; i < data.size(); i++) {
-                        data[i] = data[i - 1] + distribution(generator);
-                    }
-                } break;
-                case NON_INCREASING: {
-                    std::uniform_int_distribution<int> distribution(0, INT_MAX / data.size());
-                    data[0] = INT_MAX - distribution(generator);
-                    for (size_t i {1}; i < data.size(); i++) {
-                        data[i] = data[i - 1] - distribution(generator);
-                    }
-                } break;
-                case ALL_RANDOM: {
-                    std::uniform_int_distribution<int> distribution(0, INT_MAX);
-                    for (size_t i {0}; i < data.size(); i++) {
-                        data[i] = distribution(generator);
-                    }
-                } break;
-                case SORTED_75: 
-                    sort_percent = true;
-                    percentage = 0.25;
+                case NON_DECREASING:
+                    sa::gen::ascending(out, n, input_seed, pool);
+                    break;
+                case NON_INCREASING:
+                    sa::gen::descending(out, n, input_seed, pool);
+                    break;
+                case ALL_RANDOM:
+                    sa::gen::uniform(out, n, input_seed, pool);
+                    break;
+                case FEW_UNIQUE:
+                    sa::gen::few_unique(out, n, FEW_UNIQUE_KEYS, input_seed, pool);
                     break;
-                case SORTED_50: 
-                    sort_percent = true;
-                    percentage = 0.5;
+                case ALL_EQUAL:
+                    sa::gen::constant(out, n, input_seed, pool);
                     break;
-                case SORTED_25: 
-                    sort_percent = true;
-                    percentage = 0.75;
+                case ZIPF:
+                    sa::gen::zipf(out, n, ZIPF_KEYS, ZIPF_EXPONENT, input_seed, pool);
+                    break;
+                // Sorted keys with a fraction of them swapped out of place.
+                case SORTED_75:
+                    sa::gen::ascending(out, n, input_seed, pool);
+                    sa::gen::perturb(out, n, 0.25, sa::gen::derive_seed(input_seed, 1), pool);
+                    break;
+                case SORTED_50:
+                    sa::gen::ascending(out, n, input_seed, pool);
+                    sa::gen::perturb(out, n, 0.5, sa::gen::derive_seed(input_seed, 1), pool);
+                    break;
+                case SORTED_25:
+                    sa::gen::ascending(out, n, input_seed, pool);
+                    sa::gen::perturb(out, n, 0.75, sa::gen::derive_seed(input_seed, 1), pool);
                     break;
                 default: break;
             }
-            if (sort_percent) {
-                int I[data.size()];
-                I[0] = 0;
-                std::uniform_int_distribution<int> distribution(0, INT_MAX / data.size());
-                data[0] = distribution(generator);
-                for (size_t i {1}; i < data.size(); i++) {
-                    data[i] = data[i - 1] + distribution(generator);
-                    I[i] = i;
-                }
-                std::shuffle(I, &I[data.size()], generator);
-                for (size_t i {0}; i < percentage * data.size(); i += 2) {
-                    std::swap(data[I[i]], data[I[i + 1]]);
+            first = data.data();
+            if (cache) {
+                try {
+                    cache->store(to_string(), input_seed, first, n);
+                } catch (const std::exception& e) {
+                    std::cerr << ">>> Could not cache the input: " << e.what() << '\n';
                 }
             }
-    }
-    std::vector<int>::iterator begin_data() {
-        return data.begin();
-    }
+        }
 
-    std::vector<int>::iterator end_data() {
-        return data.end();
-    }
+        const value_type* begin_data() {
+            return first;
+        }
+
+        const value_type* end_data() {
+            return first + n;
+        }
 
 };
 
 /// Comparison function for the test experiment.
-constexpr bool compare( const int&a, const int &b ){
+constexpr bool compare( const value_type& a, const value_type& b ){
     return ( a < b );
 }
 
+/// Throws unless `sorted`: the time of an algorithm that got the order wrong is no result.
+void expect_sorted(bool sorted, const std::string& what) {
+    if (not sorted)
+        throw std::runtime_error{what + ": the output is not sorted"};
+}
+
 //=== CONSTANT DEFINITIONS.
 
-/// Number of runs we need to calculate the average runtime for a single algorithm.
-constexpr short N_RUNS = 5;
+/// Names of sa::NetworkIsa, for the result metadata.
+const char* const NETWORK_ISA_NAMES[] {"none", "scalar", "sse4", "avx2"};
 
-//=== The main function, entry point.
-int main( int argc, char * argv[] ){
-    // Process any command line arguments.
-    RunningOpt run_opt;
-    DataSet dataset{run_opt};
-    
-    // FOR EACH DATA SCENARIO DO...
-    while (not dataset.has_ended()){
-        // Collect data in a linear (arithmetic) scale.
-        // FOR EACH SAMPLE SIZE DO...
-        std::ofstream out_file;
-        out_file.open(dataset.to_string() + ".txt");
-        for (auto ns{0}; ns < run_opt.n_samples; ns++) {
-            // FOR EACH SORTING ALGORITHM DO...
-            // Select the first sorting algorithm.
-            if (ns == 0)
-                out_file << "# SIZE";
-            auto size {run_opt.min_sample_sz + run_opt.sample_step() * ns};
-            dataset.resize(size);
-            dataset.generate_data();
-
-            std::vector<int> backup;
-            backup.resize(size);
-
-            AlgorithmCollection algorithms{};
-            std::ostringstream line;
-            line << size;
-            std::cout << dataset.to_string() << ":\t>>> Size: " << size << '\n';
-            while (not algorithms.has_ended()) {
-                std::cout << "\t\t>>> Running " << algorithms.to_string() << "...\n";
-                double elapsed_time_mean = 0;
-                // Run each algorithm N_RUN times and calculate a sample avarage for each dependent variable.
-                // FOR EACH RUN DO...This is necessary to reduce any measurement noise.
-                for (auto ct_run(0); ct_run < N_RUNS; ++ct_run) {
-                    std::copy(dataset.begin_data(), dataset.end_data(), backup.begin());
-                    // Reset timer
+/// Parallel algorithms and the serial algorithm their speedup is reported against.
+constexpr std::pair<AlgorithmCode, AlgorithmCode> SPEEDUP_PAIRS[] {
+    {PARALLEL_MERGE, MERGE},
+    {PARALLEL_SAMPLE, QUICK},
+    {PARALLEL_RADIX, RADIX},
+};
+
+/// Prints the command line usage.
+void usage(const char* program) {
+    std::cerr << "Usage: " << program << " [--threads N] [--external MB [--temp-dir DIR]] [--kway] [--indirect BYTES] [--heavy] [--budget] [--select] [--batch] [--strings] [--counters] [--ops] [--memory]\n"
+              << "       [--warmup N] [--min-runs N] [--max-runs N] [--ci FRACTION] [--max-seconds S] [--pin CPU] [--output PREFIX]\n"
+              << "       [--sizes MIN MAX COUNT] [--seed N] [--cache DIR] [--cores LIST] [--cache-sweep PER_OCTAVE]\n"
+              << "  --threads N     number of threads used by the parallel algorithms (default: all cores)\n"
+              << "  --external MB   benchmark the external sort on files of up to MB megabytes instead\n"
+              << "  --temp-dir DIR  directory of the external sort files (default: the system temp directory)\n"
+              << "  --kway          benchmark merging k sorted runs of 4 MB and 128 MB in all instead\n"
+              << "  --indirect BYTES  benchmark direct against indirect sorts of records of up to BYTES bytes instead\n"
+              << "  --heavy         benchmark strings, large records and move-only elements instead\n"
+              << "  --budget        benchmark the bounded merge sort against its scratch budget instead, at the largest size\n"
+              << "  --select        benchmark nth_element, partial_sort and top_k against sorting instead, at the largest size\n"
+              << "  --batch         benchmark sorting millions of arrays of 8 to 256 elements, in arrays per second, instead\n"
+              << "  --strings       benchmark the string sorts against comparison sorts instead, at the largest size\n"
+              << "  --counters      also report cycles, instructions, branch, cache and TLB misses per algorithm\n"
+              << "  --ops           also report comparisons, copies, moves and swaps per algorithm (one extra, untimed run)\n"
+              << "  --memory        also report allocations, bytes allocated, peak heap and stack use per algorithm (one extra, untimed run)\n"
+              << "  --warmup N      untimed runs before each measurement (default: 1)\n"
+              << "  --min-runs N    timed runs of each measurement, at least (default: 5)\n"
+              << "  --max-runs N    timed runs of each measurement, at most (default: 50)\n"
+              << "  --ci FRACTION   repeat until the 95% confidence interval is within FRACTION of the mean (default: 0.02)\n"
+              << "  --max-seconds S stop repeating a measurement after S seconds (default: 2)\n"
+              << "  --pin CPU       pin the main thread to CPU and the pool workers to the following ones\n"
+              << "  --output PREFIX write the results to PREFIX.csv and PREFIX.json (default: results)\n"
+              << "  --sizes MIN MAX COUNT  benchmark COUNT sizes evenly spaced in [MIN, MAX] (default: 1000 50000 25)\n"
+              << "  --seed N        seed of the generated inputs (default: 1)\n"
+              << "  --cache DIR     keep the generated inputs in DIR and map them from there on later runs\n"
+              << "  --cores LIST    measure the serial algorithms side by side, one per CPU of LIST (e.g. 2-5,8)\n"
+              << "  --cache-sweep PER_OCTAVE  sweep sizes geometrically across the cache hierarchy, denser around each cache\n"
+              << "                  boundary (default range: 256 elements to 4x the last level cache; --sizes MIN MAX sets it)\n";
+}
+
+/// Reads the command line arguments into the running options. Returns false on bad input.
+bool parse_cli(int argc, char* argv[], RunningOpt& run_opt) {
+    for (int i {1}; i < argc; i++) {
+        if (std::strcmp(argv[i], "--threads") == 0 and i + 1 < argc) {
+            auto n_threads {std::atol(argv[++i])};
+            if (n_threads < 1)
+                return false;
+            run_opt.n_threads = n_threads;
+        } else if (std::strcmp(argv[i], "--external") == 0 and i + 1 < argc) {
+            auto max_mb {std::atol(argv[++i])};
+            if (max_mb < 1)
+                return false;
+            run_opt.external_max_mb = max_mb;
+        } else if (std::strcmp(argv[i], "--temp-dir") == 0 and i + 1 < argc) {
+            run_opt.temp_dir = argv[++i];
+        } else if (std::strcmp(argv[i], "--kway") == 0) {
+            run_opt.kway = true;
+        } else if (std::strcmp(argv[i], "--indirect") == 0 and i + 1 < argc) {
+            auto max_bytes {std::atol(argv[++i])};
+            if (max_bytes < 1)
+                return false;
+            run_opt.indirect_max_bytes = max_bytes;
+        } else if (std::strcmp(argv[i], "--heavy") == 0) {
+            run_opt.heavy = true;
+        } else if (std::strcmp(argv[i], "--budget") == 0) {
+            run_opt.budget = true;
+        } else if (std::strcmp(argv[i], "--select") == 0) {
+            run_opt.select = true;
+        } else if (std::strcmp(argv[i], "--batch") == 0) {
+            run_opt.batch = true;
+        } else if (std::strcmp(argv[i], "--strings") == 0) {
+            run_opt.strings = true;
+        } else if (std::strcmp(argv[i], "--counters") == 0) {
+            run_opt.counters = true;
+        } else if (std::strcmp(argv[i], "--ops") == 0) {
+            run_opt.ops = true;
+        } else if (std::strcmp(argv[i], "--memory") == 0) {
+            run_opt.memory = true;
+        } else if (std::strcmp(argv[i], "--warmup") == 0 and i + 1 < argc) {
+            auto warmup {std::atol(argv[++i])};
+            if (warmup < 0)
+                return false;
+            run_opt.bench.warmup = warmup;
+        } else if (std::strcmp(argv[i], "--min-runs") == 0 and i + 1 < argc) {
+            auto runs {std::atol(argv[++i])};
+            if (runs < 1)
+                return false;
+            run_opt.bench.min_runs = runs;
+        } else if (std::strcmp(argv[i], "--max-runs") == 0 and i + 1 < argc) {
+            auto runs {std::atol(argv[++i])};
+            if (runs < 1)
+                return false;
+            run_opt.bench.max_runs = runs;
+        } else if (std::strcmp(argv[i], "--ci") == 0 and i + 1 < argc) {
+            auto ci {std::atof(argv[++i])};
+            if (ci <= 0)
+                return false;
+            run_opt.bench.target_ci = ci;
+        } else if (std::strcmp(argv[i], "--max-seconds") == 0 and i + 1 < argc) {
+            auto seconds {std::atof(argv[++i])};
+            if (seconds < 0)
+                return false;
+            run_opt.bench.max_seconds = seconds;
+        } else if (std::strcmp(argv[i], "--pin") == 0 and i + 1 < argc) {
+            auto cpu {std::atol(argv[++i])};
+            if (cpu < 0)
+                return false;
+            run_opt.pin_cpu = cpu;
+        } else if (std::strcmp(argv[i], "--output") == 0 and i + 1 < argc) {
+            run_opt.output = argv[++i];
+        } else if (std::strcmp(argv[i], "--sizes") == 0 and i + 3 < argc) {
+            auto min_size {std::atol(argv[++i])};
+            auto max_size {std::atol(argv[++i])};
+            auto count {std::atol(argv[++i])};
+            if (min_size < 1 or max_size < min_size or count < 1)
+                return false;
+            run_opt.min_sample_sz = min_size;
+            run_opt.max_sample_sz = max_size;
+            run_opt.n_samples = count;
+            run_opt.sizes_given = true;
+        } else if (std::strcmp(argv[i], "--seed") == 0 and i + 1 < argc) {
+            run_opt.seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--cache") == 0 and i + 1 < argc) {
+            run_opt.cache_dir = argv[++i];
+        } else if (std::strcmp(argv[i], "--cores") == 0 and i + 1 < argc) {
+            run_opt.cores = sa::bench::parse_cpu_list(argv[++i]);
+            if (run_opt.cores.empty())
+                return false;
+        } else if (std::strcmp(argv[i], "--cache-sweep") == 0 and i + 1 < argc) {
+            auto per_octave {std::atol(argv[++i])};
+            if (per_octave < 1)
+                return false;
+            run_opt.cache_sweep = per_octave;
+        } else {
+            return false;
+        }
+    }
+    return run_opt.bench.min_runs <= run_opt.bench.max_runs;
+}
+
+//=== EXTERNAL SORT BENCHMARK.
+
+/// Fixed-width record of the external sort benchmark: a key and its payload.
+struct ExternalRecord {
+    std::uint64_t key;
+    std::uint64_t payload;
+};
+
+/// Smallest file of the external sort benchmark, in MB, unless --external asks for less; the following ones grow 4x.
+constexpr size_t EXTERNAL_MIN_FILE_MB = 16;
+/// Memory budgets the external sort is measured with, in MB.
+constexpr size_t EXTERNAL_BUDGETS_MB[] {4, 16, 64};
+
+/// Writes `n_records` random records, drawn from `seed`, to `path`.
+void write_external_input(const std::string& path, size_t n_records, std::uint64_t seed) {
+    sa::gen::CounterRng rng{seed};
+    std::vector<ExternalRecord> block(size_t{1} << 16);
+    std::ofstream file{path, std::ios::binary | std::ios::trunc};
+    for (size_t written {0}; written < n_records; written += block.size()) {
+        auto count {std::min(block.size(), n_records - written)};
+        for (size_t i {0}; i < count; i++)
+            block[i] = ExternalRecord{rng.bits(written + i), written + i};
+        file.write(reinterpret_cast<const char*>(block.data()), count * sizeof(ExternalRecord));
+    }
+    if (not file)
+        throw std::runtime_error{"cannot write " + path};
+}
+
+/// Whether `path` holds `n_records` records in non-decreasing key order.
+bool external_output_sorted(const std::string& path, size_t n_records) {
+    std::vector<ExternalRecord> block(size_t{1} << 16);
+    std::ifstream file{path, std::ios::binary};
+    std::uint64_t previous {0};
+    for (size_t read {0}; read < n_records; read += block.size()) {
+        auto count {std::min(block.size(), n_records - read)};
+        if (not file.read(reinterpret_cast<char*>(block.data()), count * sizeof(ExternalRecord)))
+            return false;
+        for (size_t i {0}; i < count; i++) {
+            if (block[i].key < previous)
+                return false;
+            previous = block[i].key;
+        }
+    }
+    return file.peek() == std::ifstream::traits_type::eof();
+}
+
+/// Measures the external sort throughput for every file size and memory budget.
+int external_benchmark(const RunningOpt& run_opt, sa::ThreadPool& pool) {
+    auto dir {run_opt.temp_dir.empty() ? std::filesystem::temp_directory_path().string() : run_opt.temp_dir};
+    auto input {dir + "/sortsuite_external_in.bin"};
+    auto output {dir + "/sortsuite_external_out.bin"};
+    auto by_key = [](const ExternalRecord& a, const ExternalRecord& b) { return a.key < b.key; };
+
+    auto metadata {sa::bench::system_metadata(run_opt.bench)};
+    metadata.emplace_back("threads", std::to_string(pool.size()));
+    metadata.emplace_back("record_bytes", std::to_string(sizeof(ExternalRecord)));
+    metadata.emplace_back("seed", std::to_string(run_opt.seed));
+    metadata.emplace_back("time_unit", "ms");
+    sa::bench::ResultWriter results{run_opt.output, metadata};
+    for (auto file_mb {std::min(EXTERNAL_MIN_FILE_MB, run_opt.external_max_mb)}; file_mb <= run_opt.external_max_mb; file_mb *= 4) {
+        auto n_records {(file_mb << 20) / sizeof(ExternalRecord)};
+        write_external_input(input, n_records, sa::gen::derive_seed(run_opt.seed, file_mb));
+        for (auto budget_mb : EXTERNAL_BUDGETS_MB) {
+            sa::ExternalSortOptions options;
+            options.memory_budget = budget_mb << 20;
+            options.temp_dir = dir;
+            std::cout << "external:\t>>> File: " << file_mb << " MB, budget: " << budget_mb << " MB\n";
+            sa::ExternalSortStats stats;
+            auto summary {sa::bench::measure(run_opt.bench, [&] {
+                auto start = std::chrono::steady_clock::now();
+                stats = sa::external_sort<ExternalRecord>(input, output, by_key, options,
+                    [&pool](auto first, auto last, auto cmp) { sa::parallel_sample(first, last, cmp, pool); });
+                auto end = std::chrono::steady_clock::now();
+                return std::chrono::duration<double, std::milli>(end - start).count();
+            })};
+            if (not external_output_sorted(output, n_records)) {
+                std::cerr << ">>> The external sort of " << file_mb << " MB with a " << budget_mb << " MB budget is not sorted.\n";
+                std::filesystem::remove(input);
+                std::filesystem::remove(output);
+                return EXIT_FAILURE;
+            }
+            auto throughput {file_mb / (summary.median * 1e-3)};
+            std::cout << "\t\t>>> " << stats.runs << " runs, " << stats.merge_passes << " merge passes: "
+                      << throughput << " MB/s\n";
+            results.add({
+                {"file_mb", file_mb},
+                {"budget_mb", budget_mb},
+                {"records", n_records},
+                {"sorted_runs", stats.runs},
+                {"merge_passes", stats.merge_passes},
+                {"runs", summary.runs},
+                {"outliers", summary.outliers},
+                {"median", summary.median},
+                {"p10", summary.p10},
+                {"p90", summary.p90},
+                {"ci", summary.ci},
+                {"mb_per_s", throughput},
+            });
+        }
+    }
+    std::filesystem::remove(input);
+    std::filesystem::remove(output);
+    return EXIT_SUCCESS;
+}
+
+//=== K-WAY MERGE BENCHMARK.
+
+/**
+ * Elements merged by the k-way merge benchmark, split evenly among the runs: 4 MB of
+ * ints, which the caches hold, then 128 MB, past the last level cache of common machines,
+ * where the passes of the pairwise merges over memory show.
+ */
+constexpr size_t KWAY_TOTALS[] {size_t{1} << 20, size_t{1} << 25};
+/// Largest number of runs of the k-way merge benchmark; k doubles from 2.
+constexpr size_t KWAY_MAX_RUNS = 4096;
+
+/**
+ * Merges the `k` consecutive sorted runs of `data` two at a time, round after round,
+ * through `scratch`, as large as `data`: the two trade places after every round.
+ */
+void pairwise_merge(std::vector<int>& data, std::vector<size_t> bounds, std::vector<int>& scratch) {
+    while (bounds.size() > 2) {
+        std::vector<size_t> merged {0};
+        for (size_t r {0}; r + 1 < bounds.size(); r += 2) {
+            auto first {data.begin() + bounds[r]};
+            if (r + 2 < bounds.size()) {
+                sa::merge_runs(first, data.begin() + bounds[r + 1], data.begin() + bounds[r + 1],
+                               data.begin() + bounds[r + 2], scratch.begin() + bounds[r], std::less<>{});
+                merged.push_back(bounds[r + 2]);
+            } else {
+                std::copy(first, data.begin() + bounds[r + 1], scratch.begin() + bounds[r]);
+                merged.push_back(bounds[r + 1]);
+            }
+        }
+        data.swap(scratch);
+        bounds = std::move(merged);
+    }
+}
+
+/// Merges the `k` consecutive sorted runs of `data` into `out` through a binary heap.
+void priority_queue_merge(const std::vector<int>& data, const std::vector<size_t>& bounds, std::vector<int>& out) {
+    using Head = std::pair<int, size_t>; // value, run
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    std::vector<size_t> next(bounds.begin(), bounds.end() - 1);
+    for (size_t r {0}; r + 1 < bounds.size(); r++)
+        if (next[r] < bounds[r + 1])
+            heads.push({data[next[r]++], r});
+    auto dest {out.begin()};
+    while (not heads.empty()) {
+        auto [value, r] {heads.top()};
+        heads.pop();
+        *dest++ = value;
+        if (next[r] < bounds[r + 1])
+            heads.push({data[next[r]++], r});
+    }
+}
+
+/**
+ * Times merging k sorted runs with the loser tree, pairwise merges and a priority queue.
+ * All three compare through inlined function objects, unlike the `compare` pointer of the sorts.
+ */
+int kway_benchmark(const RunningOpt& run_opt, sa::ThreadPool& pool) {
+    auto metadata {sa::bench::system_metadata(run_opt.bench)};
+    metadata.emplace_back("seed", std::to_string(run_opt.seed));
+    metadata.emplace_back("time_unit", "ms");
+    sa::bench::ResultWriter results{run_opt.output, metadata};
+    for (auto total : KWAY_TOTALS) {
+        std::vector<int> data(total), out(total), work, scratch(total);
+        for (size_t k {2}; k <= KWAY_MAX_RUNS; k *= 2) {
+            std::vector<size_t> bounds;
+            std::vector<std::pair<std::vector<int>::iterator, std::vector<int>::iterator>> runs;
+            for (size_t r {0}; r <= k; r++)
+                bounds.push_back(total * r / k);
+            sa::gen::uniform(data.data(), data.size(), sa::gen::derive_seed(run_opt.seed, total, k), pool);
+            for (size_t r {0}; r < k; r++) {
+                std::sort(data.begin() + bounds[r], data.begin() + bounds[r + 1]);
+                runs.push_back({data.begin() + bounds[r], data.begin() + bounds[r + 1]});
+            }
+
+            // Each merge with the vector it leaves the merged elements in.
+            const std::tuple<std::string, std::function<void()>, const std::vector<int>*> merges[] {
+                {"loser_tree", [&] { sa::kway_merge(runs, out.begin(), std::less<>{}); }, &out},
+                {"pairwise", [&] { pairwise_merge(work, bounds, scratch); }, &work},
+                {"priority_queue", [&] { priority_queue_merge(data, bounds, out); }, &out},
+            };
+            std::cout << "kway:\t>>> Total: " << total << "\t>>> K: " << k;
+            for (const auto& [name, merge, merged] : merges) {
+                auto summary {sa::bench::measure(run_opt.bench, [&] {
+                    work = data;
                     auto start = std::chrono::steady_clock::now();
-                    //================================================================================
-                    algorithms.call_curr(backup.begin(), backup.end(), compare);
-                    //================================================================================
+                    merge();
                     auto end = std::chrono::steady_clock::now();
-                    // How long did it take?
-                    auto diff {end - start};
-
-
-                    // -------------------------------------------------------------------------------
-                    // Calculating a running (repeatedly updated) sample average.
-                    // Updating elapsed time sample mean.
-                    elapsed_time_mean += (std::chrono::duration <double, std::milli> (diff).count() - elapsed_time_mean) / static_cast<double>(ct_run + 1);
-                } // Loop all runs for a single sample size.
-                // Check if the algorithm gava the right result
-                line << '\t' << std::setw(9) << elapsed_time_mean;
-                // Printing header
-                if (ns == 0)
-                    out_file << '\t' << std::setw(9) << algorithms.to_string();
-                algorithms.next();
+                    return std::chrono::duration<double, std::milli>(end - start).count();
+                })};
+                expect_sorted(std::is_sorted(merged->begin(), merged->end()), name + " of " + std::to_string(k) + " runs");
+                std::cout << '\t' << name << ' ' << summary.median << " ms";
+                results.add({
+                    {"total", total},
+                    {"bytes", total * sizeof(int)},
+                    {"k", k},
+                    {"algorithm", name},
+                    {"runs", summary.runs},
+                    {"outliers", summary.outliers},
+                    {"median", summary.median},
+                    {"p10", summary.p10},
+                    {"p90", summary.p90},
+                    {"ci", summary.ci},
+                    {"ns_per_elem", summary.median * 1e6 / total},
+                });
             }
-            // DATA COLLECTION FOR THIS SAMPLE SIZE (ROW) ENDS HERE.
-            // If this is the first time, we must first print the header.
-            // Send out data line to the output file.
-            if (ns == 0)
-                out_file << std::endl;
-            out_file << line.str() << std::endl;
-        }
-        // Go to the next active scenario.
-        dataset.next();
+            std::cout << '\n';
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+//=== INDIRECT SORT BENCHMARK.
+
+/// Records sorted by the indirect sort benchmark.
+constexpr size_t INDIRECT_RECORDS = size_t{1} << 18;
+
+/// Record of `Bytes` bytes: an int key followed by its payload.
+template <size_t Bytes>
+struct PayloadRecord {
+    int key;
+    char payload[Bytes - sizeof(int)];
+};
+
+/// Times sorting records of `Bytes` bytes directly and indirectly, adding a row per sort to `results`.
+template <size_t Bytes>
+void indirect_benchmark_row(const RunningOpt& run_opt, sa::ThreadPool& pool, sa::bench::ResultWriter& results) {
+    using Record = PayloadRecord<Bytes>;
+    std::vector<int> keys(INDIRECT_RECORDS);
+    sa::gen::uniform(keys.data(), keys.size(), sa::gen::derive_seed(run_opt.seed, Bytes), pool);
+    std::vector<Record> data(INDIRECT_RECORDS), work;
+    for (size_t i {0}; i < data.size(); i++) {
+        auto& record {data[i]};
+        record.key = keys[i];
+        std::memset(record.payload, record.key & 0xff, sizeof(record.payload));
+    }
+    auto by_key = [](const Record& a, const Record& b) { return a.key < b.key; };
+    auto key_of = [](const Record& record) { return record.key; };
+
+    const std::pair<std::string, std::function<void()>> sorts[] {
+        {"quick", [&] { sa::quick(work.begin(), work.end(), by_key); }},
+        {"merge_buf", [&] { sa::merge_buffered(work.begin(), work.end(), by_key); }},
+        {"sort_by_key", [&] { sa::sort_by_key(work.begin(), work.end(), key_of, std::less<>{}); }},
+        {"argsort", [&] {
+            auto perm {sa::argsort(work.begin(), work.end(), by_key)};
+            sa::apply_permutation(work.begin(), work.end(), perm.begin());
+        }},
+    };
+    std::cout << "indirect:\t>>> Record: " << Bytes << " bytes\n";
+    for (const auto& [name, sort] : sorts) {
+        auto summary {sa::bench::measure(run_opt.bench, [&] {
+            work = data;
+            auto start = std::chrono::steady_clock::now();
+            sort();
+            auto end = std::chrono::steady_clock::now();
+            return std::chrono::duration<double, std::milli>(end - start).count();
+        })};
+        expect_sorted(std::is_sorted(work.begin(), work.end(), by_key), name + " of " + std::to_string(Bytes) + " byte records");
+        std::cout << "\t\t>>> " << name << ": " << summary.median << " ms\n";
+        results.add({
+            {"record_bytes", Bytes},
+            {"algorithm", name},
+            {"runs", summary.runs},
+            {"outliers", summary.outliers},
+            {"median", summary.median},
+            {"p10", summary.p10},
+            {"p90", summary.p90},
+            {"ci", summary.ci},
+            {"ns_per_elem", summary.median * 1e6 / INDIRECT_RECORDS},
+        });
+    }
+}
+
+/// Record sizes of the indirect sort benchmark, up to the largest the user asked for.
+template <size_t... Bytes>
+void indirect_benchmark_rows(const RunningOpt& run_opt, sa::ThreadPool& pool, sa::bench::ResultWriter& results, std::index_sequence<Bytes...>) {
+    ((Bytes <= run_opt.indirect_max_bytes ? indirect_benchmark_row<Bytes>(run_opt, pool, results) : void()), ...);
+}
+
+/// Compares direct sorts with `sort_by_key` and `argsort` as records grow.
+int indirect_benchmark(const RunningOpt& run_opt, sa::ThreadPool& pool) {
+    auto metadata {sa::bench::system_metadata(run_opt.bench)};
+    metadata.emplace_back("records", std::to_string(INDIRECT_RECORDS));
+    metadata.emplace_back("seed", std::to_string(run_opt.seed));
+    metadata.emplace_back("time_unit", "ms");
+    sa::bench::ResultWriter results{run_opt.output, metadata};
+    indirect_benchmark_rows(run_opt, pool, results, std::index_sequence<8, 16, 32, 64, 128, 256, 512, 1024>{});
+    return EXIT_SUCCESS;
+}
+
+//=== HEAVY ELEMENTS BENCHMARK.
+
+/// Elements sorted by the heavy elements benchmark.
+constexpr size_t HEAVY_ELEMENTS = size_t{1} << 16;
+/// Length of the strings of the heavy elements benchmark, past any small string optimization.
+constexpr size_t HEAVY_STRING_LENGTH = 40;
+/// Algorithms of the heavy elements benchmark: the comparison sorts, then the standard library ones.
+const std::string HEAVY_ALGORITHMS[] {
+    "merge", "merge_buf", "merge_bu", "timsort", "par_merge", "shell", "heap",
+    "quick", "quick3", "par_sample", "std_sort", "std_stable",
+};
+
+/**
+ * Times every comparison sort over elements of type `T`, built by `make` from random keys,
+ * adding a row per sort to `results`. The elements are rebuilt before each run, so
+ * move-only types work too.
+ */
+template <typename T, typename Make, typename Compare>
+void heavy_benchmark_row(const std::string& name, Make make, Compare cmp, const RunningOpt& run_opt, sa::ThreadPool& pool,
+                         sa::bench::ResultWriter& results) {
+    std::vector<int> keys(HEAVY_ELEMENTS);
+    sa::gen::uniform(keys.data(), keys.size(), sa::gen::derive_seed(run_opt.seed, HEAVY_ELEMENTS), pool);
+    std::vector<T> work;
+
+    using It = typename std::vector<T>::iterator;
+    const std::function<void(It, It)> sorts[] {
+        [&](It first, It last) { sa::merge(first, last, cmp); },
+        [&](It first, It last) { sa::merge_buffered(first, last, cmp); },
+        [&](It first, It last) { sa::merge_bottom_up(first, last, cmp); },
+        [&](It first, It last) { sa::timsort(first, last, cmp); },
+        [&](It first, It last) { sa::parallel_merge(first, last, cmp, pool); },
+        [&](It first, It last) { sa::shell(first, last, cmp); },
+        [&](It first, It last) { sa::heap(first, last, cmp); },
+        [&](It first, It last) { sa::quick(first, last, cmp); },
+        [&](It first, It last) { sa::quick3(first, last, cmp); },
+        [&](It first, It last) { sa::parallel_sample(first, last, cmp, pool); },
+        [&](It first, It last) { std::sort(first, last, cmp); },
+        [&](It first, It last) { std::stable_sort(first, last, cmp); },
+    };
+    std::cout << "heavy:\t>>> Elements: " << name << '\n';
+    for (size_t s {0}; s < std::size(sorts); s++) {
+        auto summary {sa::bench::measure(run_opt.bench, [&] {
+            work.clear();
+            for (auto key : keys)
+                work.push_back(make(key));
+            auto start = std::chrono::steady_clock::now();
+            sorts[s](work.begin(), work.end());
+            auto end = std::chrono::steady_clock::now();
+            return std::chrono::duration<double, std::milli>(end - start).count();
+        })};
+        expect_sorted(std::is_sorted(work.begin(), work.end(), cmp), HEAVY_ALGORITHMS[s] + " of " + name + " elements");
+        std::cout << "\t\t>>> " << HEAVY_ALGORITHMS[s] << ": " << summary.median << " ms\n";
+        results.add({
+            {"type", name},
+            {"algorithm", HEAVY_ALGORITHMS[s]},
+            {"runs", summary.runs},
+            {"outliers", summary.outliers},
+            {"median", summary.median},
+            {"p10", summary.p10},
+            {"p90", summary.p90},
+            {"ci", summary.ci},
+            {"ns_per_elem", summary.median * 1e6 / HEAVY_ELEMENTS},
+        });
+    }
+}
+
+/// Times the comparison sorts over strings, large records and `unique_ptr`s.
+int heavy_benchmark(const RunningOpt& run_opt, sa::ThreadPool& pool) {
+    auto metadata {sa::bench::system_metadata(run_opt.bench)};
+    metadata.emplace_back("threads", std::to_string(pool.size()));
+    metadata.emplace_back("elements", std::to_string(HEAVY_ELEMENTS));
+    metadata.emplace_back("seed", std::to_string(run_opt.seed));
+    metadata.emplace_back("time_unit", "ms");
+    sa::bench::ResultWriter results{run_opt.output, metadata};
+
+    heavy_benchmark_row<std::string>("string",
+        [](int key) { auto digits {std::to_string(key)}; return std::string(HEAVY_STRING_LENGTH - digits.size(), '0') + digits; },
+        std::less<std::string>{}, run_opt, pool, results);
+    using Record = PayloadRecord<256>;
+    heavy_benchmark_row<Record>("record256",
+        [](int key) { Record record; record.key = key; std::memset(record.payload, key & 0xff, sizeof(record.payload)); return record; },
+        [](const Record& a, const Record& b) { return a.key < b.key; }, run_opt, pool, results);
+    heavy_benchmark_row<std::unique_ptr<int>>("unique_ptr",
+        [](int key) { return std::make_unique<int>(key); },
+        [](const std::unique_ptr<int>& a, const std::unique_ptr<int>& b) { return *a < *b; }, run_opt, pool, results);
+    return EXIT_SUCCESS;
+}
+
+//=== MEMORY BUDGET BENCHMARK.
+
+/// Scratch budgets of the bounded merge sort benchmark, as fractions of the input size.
+constexpr double BUDGET_FRACTIONS[] {0, 1.0 / 1024, 1.0 / 256, 1.0 / 64, 1.0 / 16, 1.0 / 4, 1.0 / 2};
+
+/// Times `merge_bounded` on every scenario at the largest sample size, for each scratch budget.
+int budget_benchmark(const RunningOpt& run_opt, sa::ThreadPool& pool) {
+    auto n {run_opt.max_sample_sz};
+    auto metadata {sa::bench::system_metadata(run_opt.bench)};
+    metadata.emplace_back("seed", std::to_string(run_opt.seed));
+    metadata.emplace_back("key_type", "int" + std::to_string(8 * sizeof(value_type)));
+    metadata.emplace_back("time_unit", "ms");
+    sa::bench::ResultWriter results{run_opt.output, metadata};
+
+    std::vector<value_type> work(n);
+    for (DataSet dataset{run_opt, pool}; not dataset.has_ended(); dataset.next()) {
+        dataset.resize(n);
         dataset.generate_data();
-        // Close the file corresponding to this dataset.
-        out_file.close();
+        for (auto fraction : BUDGET_FRACTIONS) {
+            auto budget {static_cast<std::ptrdiff_t>(fraction * n)};
+            std::vector<value_type> scratch(budget);
+            std::cout << dataset.to_string() << ":\t>>> Size: " << n << "\t>>> Budget: " << budget << " elements\n";
+            auto summary {sa::bench::measure(run_opt.bench, [&] {
+                std::copy(dataset.begin_data(), dataset.end_data(), work.begin());
+                auto start = std::chrono::steady_clock::now();
+                sa::merge_bounded(work.begin(), work.end(), scratch.begin(), budget, compare);
+                auto end = std::chrono::steady_clock::now();
+                return std::chrono::duration<double, std::milli>(end - start).count();
+            })};
+            expect_sorted(std::is_sorted(work.begin(), work.end(), compare),
+                          "merge_bounded with a budget of " + std::to_string(budget) + " on " + dataset.to_string());
+            results.add({
+                {"dataset", dataset.to_string()},
+                {"size", n},
+                {"budget_fraction", fraction},
+                {"budget", budget},
+                {"budget_bytes", budget * sizeof(value_type)},
+                {"runs", summary.runs},
+                {"outliers", summary.outliers},
+                {"median", summary.median},
+                {"p10", summary.p10},
+                {"p90", summary.p90},
+                {"ci", summary.ci},
+                {"ns_per_elem", summary.median * 1e6 / static_cast<double>(n)},
+            });
+        }
     }
+    return EXIT_SUCCESS;
+}
+
+//=== SELECTION BENCHMARK.
+
+/// Fractions k/n of the elements selected by the selection benchmark.
+constexpr double SELECT_RATIOS[] {1e-6, 1e-5, 1e-4, 1e-3, 1e-2, 1e-1, 0.5};
+
+/// Times selecting the k smallest elements against sorting them all, on every scenario at the largest sample size.
+int select_benchmark(const RunningOpt& run_opt, sa::ThreadPool& pool) {
+    auto n {run_opt.max_sample_sz};
+    auto metadata {sa::bench::system_metadata(run_opt.bench)};
+    metadata.emplace_back("seed", std::to_string(run_opt.seed));
+    metadata.emplace_back("key_type", "int" + std::to_string(8 * sizeof(value_type)));
+    metadata.emplace_back("time_unit", "ms");
+    sa::bench::ResultWriter results{run_opt.output, metadata};
+
+    std::vector<value_type> work(n), reference(n), top;
+    for (DataSet dataset{run_opt, pool}; not dataset.has_ended(); dataset.next()) {
+        dataset.resize(n);
+        dataset.generate_data();
+        // The results are checked against a full sort, outside the timings.
+        std::copy(dataset.begin_data(), dataset.end_data(), reference.begin());
+        std::sort(reference.begin(), reference.end(), compare);
+        auto check = [&](bool correct, const std::string& name, size_t k) {
+            expect_sorted(correct, name + " of k = " + std::to_string(k) + " on " + dataset.to_string());
+        };
+        auto time = [&](const std::string& name, size_t k, auto select) {
+            std::cout << dataset.to_string() << ":\t>>> Size: " << n << "\t>>> k: " << k << "\t>>> Running " << name << "...\n";
+            return sa::bench::measure(run_opt.bench, [&] {
+                std::copy(dataset.begin_data(), dataset.end_data(), work.begin());
+                auto start = std::chrono::steady_clock::now();
+                select(k);
+                auto end = std::chrono::steady_clock::now();
+                return std::chrono::duration<double, std::milli>(end - start).count();
+            });
+        };
+        auto add = [&](const std::string& name, double ratio, size_t k, const sa::bench::Summary& summary, double sort_median) {
+            results.add({
+                {"dataset", dataset.to_string()},
+                {"size", n},
+                {"k_ratio", ratio},
+                {"k", k},
+                {"algorithm", name},
+                {"runs", summary.runs},
+                {"outliers", summary.outliers},
+                {"median", summary.median},
+                {"p10", summary.p10},
+                {"p90", summary.p90},
+                {"ci", summary.ci},
+                {"speedup", sort_median / summary.median}, // over sorting everything
+            });
+        };
+        // Sorting does not depend on k: it is the baseline of every ratio.
+        auto sorted {time("quick", n, [&](size_t) { sa::quick(work.begin(), work.end(), compare); })};
+        check(work == reference, "quick", n);
+        add("quick", 1, n, sorted, sorted.median);
+        for (auto ratio : SELECT_RATIOS) {
+            auto k {std::max<size_t>(1, static_cast<size_t>(ratio * n))};
+            auto nth {time("nth_element", k, [&](size_t k) {
+                sa::nth_element(work.begin(), work.begin() + (k - 1), work.end(), compare);
+            })};
+            // The k-th smallest in its place, nothing greater before it and nothing smaller after it.
+            auto kth {work[k - 1]};
+            check(kth == reference[k - 1]
+                  and std::none_of(work.begin(), work.begin() + (k - 1), [&](value_type x) { return compare(kth, x); })
+                  and std::none_of(work.begin() + k, work.end(), [&](value_type x) { return compare(x, kth); }),
+                  "nth_element", k);
+            add("nth_element", ratio, k, nth, sorted.median);
+            auto partial {time("partial_sort", k, [&](size_t k) {
+                sa::partial_sort(work.begin(), work.begin() + k, work.end(), compare);
+            })};
+            check(std::equal(work.begin(), work.begin() + k, reference.begin()), "partial_sort", k);
+            add("partial_sort", ratio, k, partial, sorted.median);
+            auto selected {time("top_k", k, [&](size_t k) {
+                top = sa::top_k(work.cbegin(), work.cend(), k, compare);
+            })};
+            check(top.size() == k and std::equal(top.begin(), top.end(), reference.begin()), "top_k", k);
+            add("top_k", ratio, k, selected, sorted.median);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+//=== BATCHED SORT BENCHMARK.
+
+/// Elements of the batched sort benchmark, over all arrays.
+constexpr size_t BATCH_ELEMENTS = size_t{1} << 22;
+/// Array lengths of the batched sort benchmark; 0 stands for lengths drawn uniformly in [8, 256].
+constexpr size_t BATCH_LENGTHS[] {8, 16, 32, 64, 128, 256, 0};
+
+/// Times sorting many small arrays one call at a time against `batch_sort`, in arrays per second.
+int batch_benchmark(const RunningOpt& run_opt, sa::ThreadPool& pool) {
+    auto metadata {sa::bench::system_metadata(run_opt.bench)};
+    metadata.emplace_back("threads", std::to_string(pool.size()));
+    metadata.emplace_back("network_isa", NETWORK_ISA_NAMES[static_cast<int>(sa::network_isa())]);
+    metadata.emplace_back("seed", std::to_string(run_opt.seed));
+    metadata.emplace_back("key_type", "int" + std::to_string(8 * sizeof(value_type)));
+    metadata.emplace_back("time_unit", "ms");
+    sa::bench::ResultWriter results{run_opt.output, metadata};
+
+    using Offsets = std::vector<size_t>;
+    sa::ThreadPool single{1};
+    const std::pair<std::string, std::function<void(std::vector<value_type>&, const Offsets&)>> sorts[] {
+        {"insertion", [](auto& values, const auto& offsets) {
+            for (size_t i {0}; i + 1 < offsets.size(); i++)
+                sa::insertion(values.begin() + offsets[i], values.begin() + offsets[i + 1], std::less<>{});
+        }},
+        {"quick", [](auto& values, const auto& offsets) {
+            for (size_t i {0}; i + 1 < offsets.size(); i++)
+                sa::quick(values.begin() + offsets[i], values.begin() + offsets[i + 1], std::less<>{});
+        }},
+        {"batch_1", [&single](auto& values, const auto& offsets) {
+            sa::batch_sort(values.begin(), offsets.begin(), offsets.size() - 1, std::less<>{}, single);
+        }},
+        {"batch", [&pool](auto& values, const auto& offsets) {
+            sa::batch_sort(values.begin(), offsets.begin(), offsets.size() - 1, std::less<>{}, pool);
+        }},
+    };
+
+    std::vector<value_type> data(BATCH_ELEMENTS), work;
+    sa::gen::uniform(data.data(), data.size(), run_opt.seed, pool);
+    for (auto length : BATCH_LENGTHS) {
+        Offsets offsets {0};
+        sa::gen::CounterRng rng{sa::gen::derive_seed(run_opt.seed, length)};
+        while (offsets.back() < BATCH_ELEMENTS) {
+            auto size {length > 0 ? length : 8 + rng.below(offsets.size(), 256 - 8 + 1)};
+            offsets.push_back(std::min(offsets.back() + size, BATCH_ELEMENTS));
+        }
+        auto n_arrays {offsets.size() - 1};
+        auto shape {length > 0 ? std::to_string(length) : std::string{"8-256"}};
+        for (const auto& [name, sort] : sorts) {
+            std::cout << "batch:\t>>> Length: " << shape << "\t>>> Arrays: " << n_arrays << "\t>>> Running " << name << "...\n";
+            auto summary {sa::bench::measure(run_opt.bench, [&] {
+                work = data;
+                auto start = std::chrono::steady_clock::now();
+                sort(work, offsets);
+                auto end = std::chrono::steady_clock::now();
+                return std::chrono::duration<double, std::milli>(end - start).count();
+            })};
+            for (size_t a {0}; a < n_arrays; a++)
+                expect_sorted(std::is_sorted(work.begin() + offsets[a], work.begin() + offsets[a + 1]),
+                              name + " of arrays of length " + shape);
+            results.add({
+                {"length", shape},
+                {"arrays", n_arrays},
+                {"elements", BATCH_ELEMENTS},
+                {"algorithm", name},
+                {"runs", summary.runs},
+                {"outliers", summary.outliers},
+                {"median", summary.median},
+                {"p10", summary.p10},
+                {"p90", summary.p90},
+                {"ci", summary.ci},
+                {"arrays_per_s", n_arrays / (summary.median * 1e-3)},
+                {"ns_per_elem", summary.median * 1e6 / BATCH_ELEMENTS},
+            });
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+//=== STRING SORT BENCHMARK.
+
+/// Lengths of the prefix shared by all the strings of each dataset of the string benchmark.
+constexpr size_t STRING_PREFIXES[] {0, 8, 32, 128};
+/// The strings go on after their shared prefix with this many characters, at least and at most.
+constexpr size_t STRING_TAIL_MIN {4}, STRING_TAIL_MAX {24};
+/// Characters of the generated strings.
+constexpr std::string_view STRING_ALPHABET {"abcdefghijklmnopqrstuvwxyz0123456789/.-_"};
+
+/// Times the string sorts against comparison sorts, on strings sharing prefixes of growing length.
+int string_benchmark(const RunningOpt& run_opt) {
+    auto metadata {sa::bench::system_metadata(run_opt.bench)};
+    metadata.emplace_back("seed", std::to_string(run_opt.seed));
+    metadata.emplace_back("tail_length", std::to_string(STRING_TAIL_MIN) + "-" + std::to_string(STRING_TAIL_MAX));
+    metadata.emplace_back("time_unit", "ms");
+    sa::bench::ResultWriter results{run_opt.output, metadata};
+
+    using Views = std::vector<std::string_view>;
+    const std::pair<std::string, std::function<void(Views&)>> sorts[] {
+        {"std_sort", [](auto& views) { std::sort(views.begin(), views.end()); }},
+        {"quick", [](auto& views) { sa::quick(views.begin(), views.end(), std::less<>{}); }},
+        {"msd_radix", [](auto& views) { sa::msd_string_radix(views.begin(), views.end()); }},
+        {"multikey_quick", [](auto& views) { sa::multikey_quick(views.begin(), views.end()); }},
+        {"lcp_merge", [](auto& views) { sa::lcp_merge(views.begin(), views.end()); }},
+    };
+
+    auto n {run_opt.max_sample_sz};
+    for (auto prefix_length : STRING_PREFIXES) {
+        sa::gen::CounterRng rng{sa::gen::derive_seed(run_opt.seed, prefix_length)};
+        std::uint64_t draw {0};
+        auto next_char = [&] { return STRING_ALPHABET[rng.below(draw++, STRING_ALPHABET.size())]; };
+        std::string prefix;
+        while (prefix.size() < prefix_length)
+            prefix += next_char();
+        sa::StringArena arena;
+        arena.reserve(n, n * (prefix_length + STRING_TAIL_MAX));
+        std::vector<std::string> strings; // the same strings, one allocation each
+        strings.reserve(n);
+        for (size_t i {0}; i < n; i++) {
+            auto s {prefix};
+            auto tail {STRING_TAIL_MIN + rng.below(draw++, STRING_TAIL_MAX - STRING_TAIL_MIN + 1)};
+            while (tail-- > 0)
+                s += next_char();
+            arena.push_back(s);
+            strings.push_back(std::move(s));
+        }
+        auto views {arena.views()};
+        auto add = [&](const std::string& name, const sa::bench::Summary& summary) {
+            results.add({
+                {"prefix", prefix_length},
+                {"size", n},
+                {"chars", arena.n_chars()},
+                {"algorithm", name},
+                {"runs", summary.runs},
+                {"outliers", summary.outliers},
+                {"median", summary.median},
+                {"p10", summary.p10},
+                {"p90", summary.p90},
+                {"ci", summary.ci},
+                {"ns_per_string", summary.median * 1e6 / n},
+            });
+        };
+
+        // The baseline: std::sort on std::string, every string its own allocation.
+        std::cout << "strings:\t>>> Prefix: " << prefix_length << "\t>>> Running std_sort_string...\n";
+        std::vector<std::string> string_work;
+        add("std_sort_string", sa::bench::measure(run_opt.bench, [&] {
+            string_work = strings;
+            auto start = std::chrono::steady_clock::now();
+            std::sort(string_work.begin(), string_work.end());
+            auto end = std::chrono::steady_clock::now();
+            return std::chrono::duration<double, std::milli>(end - start).count();
+        }));
+        expect_sorted(std::is_sorted(string_work.begin(), string_work.end()),
+                      "std_sort_string of a " + std::to_string(prefix_length) + " character prefix");
+        Views work;
+        for (const auto& [name, sort] : sorts) {
+            std::cout << "strings:\t>>> Prefix: " << prefix_length << "\t>>> Running " << name << "...\n";
+            auto summary {sa::bench::measure(run_opt.bench, [&] {
+                work = views;
+                auto start = std::chrono::steady_clock::now();
+                sort(work);
+                auto end = std::chrono::steady_clock::now();
+                return std::chrono::duration<double, std::milli>(end - start).count();
+            })};
+            expect_sorted(std::is_sorted(work.begin(), work.end()),
+                          name + " of a " + std::to_string(prefix_length) + " character prefix");
+            add(name, summary);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+//=== CELL SCHEDULER.
+
+/**
+ * Whether the cells of `code` must run with no other cell beside them: the parallel
+ * algorithms need the whole pool, and the *_less ones switch the network leaves off
+ * for the whole process while they run.
+ */
+constexpr bool runs_alone(AlgorithmCode code) {
+    for (const auto& pair : SPEEDUP_PAIRS)
+        if (pair.first == code)
+            return true;
+    return code == MERGE_LESS or code == QUICK_LESS;
+}
+
+/// Smallest size of the cache sweep, unless --sizes sets it.
+constexpr size_t CACHE_SWEEP_MIN {256};
+/// The cache sweep goes up to this many times the last level cache, unless --sizes sets it.
+constexpr size_t CACHE_SWEEP_BEYOND_LLC {4};
+/// In the cache sweep, the quadratic sorts stop at this size: past it a single run takes seconds.
+constexpr size_t CACHE_SWEEP_QUADRATIC_MAX {1 << 16};
+
+/// The data caches of the host, detected once.
+const std::vector<sa::bench::CacheLevel>& host_caches() {
+    static const auto caches {sa::bench::data_caches()};
+    return caches;
+}
+
+/// The sizes to benchmark: linearly spaced, or across the cache hierarchy with --cache-sweep.
+std::vector<size_t> sample_sizes(RunningOpt& run_opt) {
+    std::vector<size_t> sizes;
+    if (run_opt.cache_sweep == 0) {
+        for (auto ns{0}; ns < run_opt.n_samples; ns++)
+            sizes.push_back(run_opt.min_sample_sz + run_opt.sample_step() * ns);
+        return sizes;
+    }
+    auto min_n {run_opt.sizes_given ? run_opt.min_sample_sz : CACHE_SWEEP_MIN};
+    auto max_n {run_opt.max_sample_sz};
+    if (not run_opt.sizes_given and not host_caches().empty())
+        max_n = CACHE_SWEEP_BEYOND_LLC * host_caches().back().bytes / sizeof(value_type);
+    return sa::bench::cache_sweep_sizes(host_caches(), sizeof(value_type), min_n, max_n, run_opt.cache_sweep);
+}
+
+/// Whether `code` is one of the quadratic sorts.
+constexpr bool is_quadratic(AlgorithmCode code) {
+    return code == BUBBLE or code == INSERTION or code == SELECTION;
+}
+
+/// Rough relative cost of sorting `n` elements with `code`, to start the longest cells first.
+double expected_cost(AlgorithmCode code, size_t n) {
+    if (is_quadratic(code))
+        return static_cast<double>(n) * n;
+    switch (code) {
+        case SHELL:
+        case SHELL_CIURA:
+        case SHELL_TOKUDA:
+        case SHELL_SEDGEWICK:
+        case SHELL_PRATT:
+            return std::pow(n, 1.25) * 4;
+        default:
+            return n * std::log2(n + 1.0);
+    }
+}
+
+/// One measurement: an algorithm sorting the input of a scenario and size.
+struct Cell {
+    DataCode dataset;
+    size_t size;
+    AlgorithmCode algorithm;
+};
+
+/// The result of a cell: its row in the report and its median time.
+struct CellResult {
+    sa::bench::Row row;
+    double median;
+};
+
+/**
+ * @brief Measures cells on the calling thread, with its own input and working copy.
+ *
+ * Each thread measuring cells owns one, so no memory is shared between cells measured
+ * side by side; consecutive cells of the same input skip generating it again.
+ */
+class CellRunner {
+    const RunningOpt& run_opt;
+    sa::ThreadPool& pool;
+    sa::PerfCounters& counters;
+    bool alone; //!< No other cell runs meanwhile, so the allocations of every thread are the cell's.
+    DataSet dataset;
+    std::vector<value_type> backup;
+    size_t generated_size {0};
+    DataCode generated_dataset {START_DATA};
+
+    public:
+        CellRunner(const RunningOpt& run_opt, sa::ThreadPool& pool, sa::PerfCounters& counters, bool alone)
+            : run_opt{run_opt}, pool{pool}, counters{counters}, alone{alone}, dataset{run_opt, pool} {}
+
+        CellResult run(const Cell& cell) {
+            if (cell.dataset != generated_dataset or cell.size != generated_size) {
+                dataset.select(cell.dataset);
+                dataset.resize(cell.size);
+                dataset.generate_data();
+                generated_dataset = cell.dataset;
+                generated_size = cell.size;
+            }
+            backup.resize(cell.size);
+            AlgorithmCollection algorithms{pool};
+            algorithms.select(cell.algorithm);
+            {
+                std::lock_guard<std::mutex> lock{output_mutex()};
+                std::cout << dataset.to_string() << ":\t>>> Size: " << cell.size << "\t>>> Running " << algorithms.to_string() << "...\n";
+            }
+
+            std::vector<sa::PerfSample> counts;
+            // The engine repeats the run until the timings are stable enough.
+            auto summary {sa::bench::measure(run_opt.bench, [&] {
+                std::copy(dataset.begin_data(), dataset.end_data(), backup.begin());
+                // The counters wrap the timer, so their ioctls are not timed.
+                if (run_opt.counters)
+                    counters.start();
+                auto start = std::chrono::steady_clock::now();
+                //================================================================================
+                algorithms.call_curr(backup.begin(), backup.end(), compare);
+                //================================================================================
+                auto end = std::chrono::steady_clock::now();
+                if (run_opt.counters)
+                    counts.push_back(counters.stop());
+                return std::chrono::duration<double, std::milli>(end - start).count();
+            })};
+            expect_sorted(std::is_sorted(backup.begin(), backup.end(), compare),
+                          algorithms.to_string() + " on " + dataset.to_string() + " of " + std::to_string(cell.size));
+
+            sa::bench::Row row {
+                {"dataset", dataset.to_string()},
+                {"size", cell.size},
+                {"algorithm", algorithms.to_string()},
+                {"cpu", sched_getcpu()},
+                {"runs", summary.runs},
+                {"outliers", summary.outliers},
+                {"median", summary.median},
+                {"p10", summary.p10},
+                {"p90", summary.p90},
+                {"mean", summary.mean},
+                {"stddev", summary.stddev},
+                {"ci", summary.ci},
+                {"min", summary.min},
+                {"max", summary.max},
+                {"speedup", std::numeric_limits<double>::quiet_NaN()}, // filled in by the CellReport
+            };
+            // Normalized by the size, to compare sizes across the cache hierarchy.
+            auto n {static_cast<double>(cell.size)};
+            auto bytes {cell.size * sizeof(value_type)};
+            row.emplace_back("bytes", bytes);
+            row.emplace_back("fits_in", sa::bench::fitting_level(host_caches(), bytes));
+            row.emplace_back("ns_per_elem", summary.median * 1e6 / n);
+            row.emplace_back("ns_per_nlogn", summary.median * 1e6 / (n * std::log2(std::max(n, 2.0))));
+            row.emplace_back("gb_per_s", bytes / (summary.median * 1e6)); // input bytes sorted per second
+            // Hardware counters, averaged over the timed runs (the warmup ones come first).
+            for (size_t e {0}; run_opt.counters and e < sa::N_PERF_EVENTS; e++) {
+                double sum {0};
+                for (auto r {counts.size() - summary.runs}; r < counts.size(); r++)
+                    sum += counts[r][e];
+                row.emplace_back(sa::PerfCounters::name(static_cast<sa::PerfEvent>(e)), sum / summary.runs);
+            }
+            // Operation counts come from a separate run over counted elements, so the
+            // timed runs above sort plain keys with the plain comparator.
+            if (run_opt.ops) {
+                std::vector<sa::Counted<value_type>> counted(dataset.begin_data(), dataset.end_data());
+                sa::op_count::reset();
+                algorithms.call_curr(counted.begin(), counted.end(), sa::counting(compare));
+                auto ops {sa::op_count::read()};
+                row.emplace_back("comparisons", ops.comparisons);
+                row.emplace_back("copies", ops.copies);
+                row.emplace_back("moves", ops.moves);
+                row.emplace_back("swaps", ops.swaps);
+            }
+            // Heap and stack use, from one more run on a probe thread: allocations are
+            // deterministic, and counting them would slow the timed runs down.
+            if (run_opt.memory) {
+                std::copy(dataset.begin_data(), dataset.end_data(), backup.begin());
+                auto usage {sa::memory::measure([&] {
+                    algorithms.call_curr(backup.begin(), backup.end(), compare);
+                }, alone)};
+                row.emplace_back("allocs", usage.allocations);
+                row.emplace_back("alloc_bytes", usage.bytes);
+                row.emplace_back("peak_bytes", usage.peak);
+                row.emplace_back("stack_bytes", usage.stack);
+            }
+            return {std::move(row), summary.median};
+        }
+
+        /// Serializes the progress messages of the threads measuring cells.
+        static std::mutex& output_mutex() {
+            static std::mutex mtx;
+            return mtx;
+        }
+};
+
+/**
+ * @brief Collects the results of cells finishing in any order, and writes them in
+ * cell order, as soon as every cell before them is done.
+ *
+ * A parallel algorithm comes after its serial counterpart in the cell order, so its
+ * speedup can be filled in when it is written.
+ */
+class CellReport {
+    const std::vector<Cell>& cells;
+    sa::bench::ResultWriter& results;
+    std::vector<std::optional<CellResult>> done;
+    size_t next_to_write {0};
+    std::mutex mtx;
+
+    public:
+        CellReport(const std::vector<Cell>& cells, sa::bench::ResultWriter& results)
+            : cells{cells}, results{results}, done(cells.size()) {}
+
+        void add(size_t index, CellResult result) {
+            std::lock_guard<std::mutex> lock{mtx};
+            done[index] = std::move(result);
+            for (; next_to_write < cells.size() and done[next_to_write]; next_to_write++) {
+                auto& row {done[next_to_write]->row};
+                for (const auto& pair : SPEEDUP_PAIRS) {
+                    if (pair.first != cells[next_to_write].algorithm)
+                        continue;
+                    // The serial counterpart is among the cells of the same input, before this one.
+                    const auto& cell {cells[next_to_write]};
+                    auto serial {next_to_write};
+                    while (serial > 0 and cells[serial - 1].dataset == cell.dataset and cells[serial - 1].size == cell.size
+                           and cells[serial - 1].algorithm != pair.second)
+                        serial--;
+                    if (serial == 0 or cells[serial - 1].algorithm != pair.second)
+                        continue;
+                    serial--;
+                    auto speedup {done[serial]->median / done[next_to_write]->median};
+                    for (auto& [column, value] : row)
+                        if (column == "speedup")
+                            value = speedup;
+                    // Columns 0 and 2 are the dataset and the algorithm.
+                    std::lock_guard<std::mutex> out_lock{CellRunner::output_mutex()};
+                    std::cout << "\t\t>>> Speedup of " << row[2].second.text << " over " << done[serial]->row[2].second.text
+                              << " on " << row[0].second.text << ": " << speedup << "x\n";
+                }
+                results.add(row);
+            }
+        }
+};
+
+//=== The main function, entry point.
+int main( int argc, char * argv[] ) try {
+    // Process any command line arguments.
+    RunningOpt run_opt;
+    if (not parse_cli(argc, argv, run_opt)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    sa::ThreadPool pool{run_opt.n_threads};
+    if (run_opt.external_max_mb > 0)
+        return external_benchmark(run_opt, pool);
+    if (run_opt.kway)
+        return kway_benchmark(run_opt, pool);
+    if (run_opt.indirect_max_bytes > 0)
+        return indirect_benchmark(run_opt, pool);
+    if (run_opt.heavy)
+        return heavy_benchmark(run_opt, pool);
+    if (run_opt.budget)
+        return budget_benchmark(run_opt, pool);
+    if (run_opt.select)
+        return select_benchmark(run_opt, pool);
+    if (run_opt.batch)
+        return batch_benchmark(run_opt, pool);
+    if (run_opt.strings)
+        return string_benchmark(run_opt);
+    bool pinned {run_opt.pin_cpu >= 0};
+    if (pinned and not sa::bench::pin_threads(run_opt.pin_cpu)) {
+        std::cerr << ">>> Could not pin the threads from CPU " << run_opt.pin_cpu << ", running unpinned.\n";
+        pinned = false;
+    }
+    // Opened after the pool, so its workers are counted too.
+    sa::PerfCounters counters{run_opt.counters};
+    if (run_opt.counters and not counters.error().empty())
+        std::cerr << ">>> Some hardware counters are not available (" << counters.error() << "), they are reported as nan.\n";
+    auto metadata {sa::bench::system_metadata(run_opt.bench)};
+    metadata.emplace_back("threads", std::to_string(pool.size()));
+    metadata.emplace_back("pinned_from_cpu", pinned ? std::to_string(run_opt.pin_cpu) : "none");
+    std::string cores;
+    for (auto cpu : run_opt.cores)
+        cores += (cores.empty() ? "" : " ") + std::to_string(cpu);
+    metadata.emplace_back("cell_cores", cores.empty() ? "none" : cores);
+    for (const auto& cache : host_caches())
+        metadata.emplace_back("cache_l" + std::to_string(cache.level), std::to_string(cache.bytes));
+    metadata.emplace_back("sweep", run_opt.cache_sweep > 0 ? std::to_string(run_opt.cache_sweep) + " per octave, cache boundaries" : "linear");
+    metadata.emplace_back("network_isa", NETWORK_ISA_NAMES[static_cast<int>(sa::network_isa())]);
+    metadata.emplace_back("counters", run_opt.counters ? (counters.error().empty() ? "all" : counters.error()) : "off");
+#ifdef SA_MEMORY_HOOK_MALLOC
+    metadata.emplace_back("memory", run_opt.memory ? "operator new, malloc" : "off");
+#else
+    metadata.emplace_back("memory", run_opt.memory ? "operator new" : "off");
+#endif
+    metadata.emplace_back("seed", std::to_string(run_opt.seed));
+    metadata.emplace_back("key_type", "int" + std::to_string(8 * sizeof(value_type)));
+    metadata.emplace_back("time_unit", "ms");
+    sa::bench::ResultWriter results{run_opt.output, metadata};
+
+    // FOR EACH DATA SCENARIO, SAMPLE SIZE AND SORTING ALGORITHM DO...
+    auto sizes {sample_sizes(run_opt)};
+    std::vector<Cell> cells;
+    for (int d {START_DATA + 1}; d < END_DATA; d++)
+        for (auto size : sizes)
+            for (int a {START_ALGR + 1}; a < END_ALGR; a++) {
+                auto code {static_cast<AlgorithmCode>(a)};
+                if (run_opt.cache_sweep > 0 and is_quadratic(code) and size > CACHE_SWEEP_QUADRATIC_MAX)
+                    continue;
+                cells.push_back({static_cast<DataCode>(d), size, code});
+            }
+    CellReport report{cells, results};
+
+    std::vector<size_t> serial, exclusive;
+    for (size_t c {0}; c < cells.size(); c++)
+        (runs_alone(cells[c].algorithm) or run_opt.cores.empty() ? exclusive : serial).push_back(c);
+    // The other cells go first, side by side on their own cores, the longest ones first.
+    std::stable_sort(serial.begin(), serial.end(), [&](size_t a, size_t b) {
+        return expected_cost(cells[a].algorithm, cells[a].size) > expected_cost(cells[b].algorithm, cells[b].size);
+    });
+    std::atomic<size_t> next_serial{0};
+    std::exception_ptr failure;
+    std::mutex failure_mutex;
+    auto all_pinned {sa::bench::on_pinned_threads(run_opt.cores, [&](size_t) {
+        sa::ThreadPool own_pool{1};
+        sa::PerfCounters own_counters{run_opt.counters, true};
+        sa::op_count::PrivateScope own_op_counts;
+        CellRunner runner{run_opt, own_pool, own_counters, false};
+        try {
+            for (size_t k; (k = next_serial++) < serial.size();)
+                report.add(serial[k], runner.run(cells[serial[k]]));
+        } catch (...) {
+            // Raised again on the main thread; the other threads finish their cell and stop.
+            std::lock_guard<std::mutex> lock{failure_mutex};
+            if (not failure)
+                failure = std::current_exception();
+            next_serial = serial.size();
+        }
+    })};
+    if (failure)
+        std::rethrow_exception(failure);
+    if (not all_pinned)
+        std::cerr << ">>> Could not pin some of the cell threads to their CPU.\n";
+    // Then the ones that must run alone, on the main thread with the whole pool (every cell, without --cores).
+    CellRunner runner{run_opt, pool, counters, true};
+    for (auto c : exclusive)
+        report.add(c, runner.run(cells[c]));
 
     return EXIT_SUCCESS;
+} catch (const std::exception& e) {
+    // Results that cannot be written, say: fail rather than lose them silently.
+    std::cerr << ">>> " << e.what() << '\n';
+    return EXIT_FAILURE;
 }